@@ -1,13 +1,27 @@
 #! /usr/bin/python3
+# Benchmark runner for the traversal kernels.
+#
+# Every configuration (scene, ray distribution, variant, and tool) is run several times, in rounds.
+# The order of the configurations changes from one round to the next, so that slow drifts of the machine
+# (temperature, frequency, background load) are spread over all configurations instead of biasing some of them.
+# Each run reports the timing of every iteration, which gives the samples used for the statistics.
+# Rounds are added until the confidence interval of the median of every configuration is narrow enough.
+import argparse
+import csv
+import json
+import math
+import os
+import platform
+import random
 import subprocess
+import sys
 
-iters = "50"
-warmups = "10"
 bench_rodent = "../build/bin/bench_traversal"
 bench_embree = "../build/bin/bench_embree"
 variants = ["-w 4", "-w 4 -p", "-w 4 -s", "-w 8", "-w 8 -p", "-w 8 -s"]
+distribs = ["primary", "ao", "bounces"]
 scenes = [
-    "sponza", 
+    "sponza",
     "crown",
     "san-miguel",
     "powerplant"
@@ -19,28 +33,253 @@ offsets = {
     "powerplant": (0.01, 1000.0)
 }
 
-def bench_mrays(args):
-    pipe = subprocess.Popen(args, stdout = subprocess.PIPE)  
-    for line in pipe.stdout:
+def warn(msg):
+    print("warning: " + msg, file = sys.stderr)
+
+# Frequency scaling and turbo modes make timings depend on the load and the temperature of the machine
+def check_machine(cpus):
+    for cpu in cpus:
+        governor = "/sys/devices/system/cpu/cpu{}/cpufreq/scaling_governor".format(cpu)
+        if os.path.exists(governor):
+            with open(governor) as f:
+                mode = f.read().strip()
+            if mode != "performance":
+                warn("CPU {} uses the '{}' frequency governor (use 'performance')".format(cpu, mode))
+    no_turbo = "/sys/devices/system/cpu/intel_pstate/no_turbo"
+    if os.path.exists(no_turbo):
+        with open(no_turbo) as f:
+            if f.read().strip() == "0":
+                warn("turbo boost is enabled")
+    boost = "/sys/devices/system/cpu/cpufreq/boost"
+    if os.path.exists(boost):
+        with open(boost) as f:
+            if f.read().strip() == "1":
+                warn("frequency boost is enabled")
+
+class Config:
+    def __init__(self, scene, rays, variant, tool):
+        self.scene   = scene
+        self.rays    = rays
+        self.variant = variant
+        self.tool    = tool
+        self.samples = []   # Throughput of every iteration, in Mrays/s
+
+    def key(self):
+        return "{} : {} : {} : {}".format(self.scene, self.rays, self.variant, self.tool)
+
+    def command(self, args):
+        (tmin, ao_max) = offsets[self.scene]
+        tmax = ao_max if self.rays == "ao" else 1.0e9
+        prefix = "scenes/" + self.scene + "/" + self.scene
+        if self.tool == "embree":
+            cmd = [args.embree, "-obj", prefix + ".obj"]
+        else:
+            cmd = [args.rodent, "-bvh", prefix + ".bvh"]
+        return cmd + [
+            "-ray", "scenes/" + self.scene + "/" + self.rays + ".rays",
+            "-tmin", str(tmin), "-tmax", str(tmax),
+            "-bench", str(args.iters), "-warmup", str(args.warmup)
+        ] + self.variant.split()
+
+# Runs the tool once, and returns the throughput of every iteration
+def run(config, args):
+    cpus = args.cpus
+    def pin():
+        if cpus:
+            os.sched_setaffinity(0, cpus)
+    proc = subprocess.run(config.command(args), stdout = subprocess.PIPE, preexec_fn = pin)
+    if proc.returncode != 0:
+        warn("'{}' failed with code {}".format(" ".join(config.command(args)), proc.returncode))
+        return []
+    num_rays = None
+    timings = []
+    for line in proc.stdout.decode().splitlines():
         elems = line.split()
-        if elems[1] == b'Mrays/sec':
-            return float(elems[0])
-    return None
+        if len(elems) >= 2 and elems[1] == "ray(s)":
+            num_rays = int(elems[0])
+        elif line.startswith("# Timings (ms):"):
+            timings = [float(t) for t in elems[3:]]
+    if num_rays is None or not timings:
+        warn("cannot parse the output of '{}'".format(" ".join(config.command(args))))
+        return []
+    return [num_rays / (1000.0 * t) for t in timings if t > 0]
+
+def median(values):
+    values = sorted(values)
+    n = len(values)
+    return values[n // 2] if n % 2 == 1 else 0.5 * (values[n // 2 - 1] + values[n // 2])
+
+# Removes the samples that are further than k scaled median absolute deviations from the median
+def remove_outliers(values, k):
+    med = median(values)
+    mad = 1.4826 * median([abs(v - med) for v in values])
+    if mad == 0:
+        return values, 0
+    kept = [v for v in values if abs(v - med) <= k * mad]
+    return kept, len(values) - len(kept)
+
+# Bootstrap confidence interval of the median
+def median_ci(values, confidence, resamples = 1000):
+    rng = random.Random(0)
+    meds = sorted(median(rng.choices(values, k = len(values))) for _ in range(resamples))
+    lo = int((1.0 - confidence) / 2 * resamples)
+    hi = min(resamples - 1, int((1.0 + confidence) / 2 * resamples))
+    return meds[lo], meds[hi]
+
+# Two-sided Mann-Whitney U test with the normal approximation (with tie correction), returns the p-value
+def mann_whitney(a, b):
+    n1, n2 = len(a), len(b)
+    if n1 == 0 or n2 == 0:
+        return 1.0
+    values = sorted([(v, 0) for v in a] + [(v, 1) for v in b])
+    ranks = [0.0] * len(values)
+    ties = 0.0
+    i = 0
+    while i < len(values):
+        j = i
+        while j + 1 < len(values) and values[j + 1][0] == values[i][0]:
+            j += 1
+        for k in range(i, j + 1):
+            ranks[k] = 0.5 * (i + j) + 1
+        t = j - i + 1
+        ties += t * t * t - t
+        i = j + 1
+    r1 = sum(r for r, (_, group) in zip(ranks, values) if group == 0)
+    u = r1 - n1 * (n1 + 1) / 2
+    n = n1 + n2
+    sigma = math.sqrt(n1 * n2 / 12.0 * ((n + 1) - ties / (n * (n - 1))))
+    if sigma == 0:
+        return 1.0
+    z = (abs(u - n1 * n2 / 2.0) - 0.5) / sigma
+    return math.erfc(max(z, 0.0) / math.sqrt(2))
+
+def summarize(config, args):
+    kept, outliers = remove_outliers(config.samples, args.outlier_mads)
+    lo, hi = median_ci(kept, args.confidence)
+    med = median(kept)
+    return {
+        "scene":    config.scene,
+        "rays":     config.rays,
+        "variant":  config.variant,
+        "tool":     config.tool,
+        "samples":  len(kept),
+        "outliers": outliers,
+        "median":   med,
+        "mean":     sum(kept) / len(kept),
+        "min":      min(kept),
+        "max":      max(kept),
+        "ci_low":   lo,
+        "ci_high":  hi,
+        "rel_ci":   (hi - lo) / (2.0 * med) if med > 0 else float("inf")
+    }
+
+def compare(results, baseline, args):
+    base = { "{} : {} : {} : {}".format(r["scene"], r["rays"], r["variant"], r["tool"]): r for r in baseline["results"] }
+    print("Comparison with the baseline (alpha = {}):".format(args.alpha))
+    regressions = 0
+    for res in results:
+        key = "{} : {} : {} : {}".format(res["scene"], res["rays"], res["variant"], res["tool"])
+        if key not in base:
+            print("    {} : not in the baseline".format(key))
+            continue
+        ref = base[key]
+        p = mann_whitney(res["raw"], ref["raw"])
+        change = 100.0 * (res["median"] - ref["median"]) / ref["median"]
+        verdict = "same"
+        if p < args.alpha:
+            verdict = "faster" if change > 0 else "SLOWER"
+            regressions += change < 0
+        print("    {} : {:0.3f} -> {:0.3f} Mrays/s ({:+0.1f}%, p = {:0.3g}) {}".format(key, ref["median"], res["median"], change, p, verdict))
+    return regressions
 
 def main():
-    distribs = ["primary", "ao", "bounces"]
-    for scene in scenes:
-        for variant in variants:
-            for rays in distribs:
-                (tmin, ao_max) = offsets[scene]
-                tmax = 1.0e9
-                if rays == "ao":
-                    tmax = ao_max
-                args = ["-ray", "scenes/" + scene + "/" + rays + ".rays", "-tmin", str(tmin), "-tmax", str(tmax), "-bench", iters, "-warmup", warmups] + variant.split()
-                #print(scene, ": ", " ".join(args))
-                mrays_embree = bench_mrays([bench_embree, "-obj", "scenes/" + scene + "/" + scene + ".obj"] + args) if not "-p" in variant else None
-                mrays_rodent = bench_mrays([bench_rodent, "-bvh", "scenes/" + scene + "/" + scene + ".bvh"] + args)
-                print("{} : {} : {} : {} : {}".format(scene, rays, variant, mrays_embree, mrays_rodent))
+    parser = argparse.ArgumentParser(description = "Runs the traversal benchmarks and computes statistics on the results.")
+    parser.add_argument("--rodent", default = bench_rodent, help = "path to bench_traversal")
+    parser.add_argument("--embree", default = bench_embree, help = "path to bench_embree (empty to skip Embree)")
+    parser.add_argument("--scenes", nargs = "+", default = scenes, choices = scenes)
+    parser.add_argument("--rays", nargs = "+", default = distribs, choices = distribs)
+    parser.add_argument("--variants", nargs = "+", default = variants)
+    parser.add_argument("--iters", type = int, default = 10, help = "iterations per run")
+    parser.add_argument("--warmup", type = int, default = 2, help = "warmup iterations per run")
+    parser.add_argument("--min-rounds", type = int, default = 5, help = "minimum number of runs per configuration")
+    parser.add_argument("--max-rounds", type = int, default = 30, help = "maximum number of runs per configuration")
+    parser.add_argument("--precision", type = float, default = 0.01, help = "target half-width of the confidence interval, relative to the median")
+    parser.add_argument("--confidence", type = float, default = 0.95, help = "confidence level of the intervals")
+    parser.add_argument("--outlier-mads", type = float, default = 5.0, help = "samples further than this many MADs from the median are outliers")
+    parser.add_argument("--cpus", type = int, nargs = "+", default = [], help = "CPUs to pin the benchmarks to")
+    parser.add_argument("--json", help = "writes the results (with all samples) to this JSON file")
+    parser.add_argument("--csv", help = "writes a summary of the results to this CSV file")
+    parser.add_argument("--text", help = "writes the medians to this file, in the format read by gen_table.py")
+    parser.add_argument("--baseline", help = "JSON file of a previous run to compare against")
+    parser.add_argument("--alpha", type = float, default = 0.01, help = "significance level of the comparison")
+    args = parser.parse_args()
+
+    check_machine(args.cpus if args.cpus else range(os.cpu_count()))
+
+    configs = []
+    for scene in args.scenes:
+        for rays in args.rays:
+            for variant in args.variants:
+                configs.append(Config(scene, rays, variant, "rodent"))
+                # Embree has no packet traversal
+                if args.embree and "-p" not in variant.split():
+                    configs.append(Config(scene, rays, variant, "embree"))
+
+    # Configurations are run in a different order in every round
+    rng = random.Random(42)
+    pending = list(configs)
+    rounds = 0
+    while pending and rounds < args.max_rounds:
+        rounds += 1
+        rng.shuffle(pending)
+        for config in pending:
+            config.samples += run(config, args)
+        print("Round {}: {} configuration(s) run".format(rounds, len(pending)), file = sys.stderr)
+        if rounds >= args.min_rounds:
+            pending = [c for c in pending if not c.samples or summarize(c, args)["rel_ci"] > args.precision]
+
+    results = []
+    for config in configs:
+        if not config.samples:
+            warn("no samples for '{}'".format(config.key()))
+            continue
+        res = summarize(config, args)
+        if res["rel_ci"] > args.precision:
+            warn("'{}' did not reach the target precision ({:0.2f}%)".format(config.key(), 100.0 * res["rel_ci"]))
+        res["raw"] = config.samples
+        results.append(res)
+        print("{} : {:0.3f} Mrays/s [{:0.3f}, {:0.3f}] ({} samples, {} outliers)".format(
+            config.key(), res["median"], res["ci_low"], res["ci_high"], res["samples"], res["outliers"]))
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump({
+                "machine": { "node": platform.node(), "processor": platform.processor(), "cpus": args.cpus },
+                "settings": { "iters": args.iters, "warmup": args.warmup, "confidence": args.confidence },
+                "results": results
+            }, f, indent = 2)
+
+    if args.csv:
+        fields = ["scene", "rays", "variant", "tool", "samples", "outliers", "median", "mean", "min", "max", "ci_low", "ci_high"]
+        with open(args.csv, "w", newline = "") as f:
+            writer = csv.DictWriter(f, fieldnames = fields, extrasaction = "ignore")
+            writer.writeheader()
+            writer.writerows(results)
+
+    if args.text:
+        medians = { (r["scene"], r["rays"], r["variant"], r["tool"]): r["median"] for r in results }
+        with open(args.text, "w") as f:
+            for scene in args.scenes:
+                for variant in args.variants:
+                    for rays in args.rays:
+                        f.write("{} : {} : {} : {} : {}\n".format(scene, rays, variant,
+                            medians.get((scene, rays, variant, "embree")), medians.get((scene, rays, variant, "rodent"))))
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if compare(results, baseline, args) > 0:
+            sys.exit(1)
 
 if __name__ == "__main__":
     main()
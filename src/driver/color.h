@@ -34,6 +34,10 @@ struct rgba : public float4 {
 
 inline rgb::rgb(const rgba& rgba) : float3(rgba) {}
 
+inline float luminance(const rgb& c) {
+    return c.x * 0.2126f + c.y * 0.7152f + c.z * 0.0722f;
+}
+
 inline rgb gamma(const rgb& c, float g = 0.5f) {
     return rgb(std::pow(c.x, g), std::pow(c.y, g), std::pow(c.z, g));
 }
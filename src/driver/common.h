@@ -8,6 +8,8 @@
 
 #include <immintrin.h>
 
+static constexpr float pi = 3.14159265359f;
+
 // Parallel bits deposit. Optimized for BMI2 instruction set.
 inline uint32_t pdep(uint32_t val, uint32_t mask) {
 #ifdef __BMI2__
@@ -1,13 +1,17 @@
 #include <memory>
 #include <sstream>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
 #include <SDL2/SDL.h>
 
 #include "interface.h"
+#include "scene_file.h"
 #include "float3.h"
 #include "common.h"
 
-static constexpr float pi = 3.14159265359f;
-
 struct Camera {
     float3 eye;
     float3 dir;
@@ -38,11 +42,17 @@ struct Camera {
     }
 };
 
-void setup_cpu_interface(size_t, size_t);
+void setup_cpu_interface(size_t, size_t, float, bool);
+void load_cpu_assets(const std::string&);
+bool load_cpu_scene(const std::string&, scene::Camera&);
 Color* get_cpu_pixels();
+const int32_t* get_cpu_sample_counts();
+void clear_cpu_film();
 void cleanup_cpu_interface();
+void start_cpu_ray_capture();
+void finish_cpu_ray_capture(const std::string&);
 
-static bool handle_events(uint32_t& iter, Camera& cam) {
+static bool handle_events(uint32_t& iter, Camera& cam, bool& show_samples) {
     static bool camera_on = false;
     bool arrows[4] = { false, false, false, false };
     bool speed[2] = { false, false };
@@ -63,6 +73,7 @@ static bool handle_events(uint32_t& iter, Camera& cam) {
                     case SDLK_DOWN:     arrows[1] = key_down; break;
                     case SDLK_LEFT:     arrows[2] = key_down; break;
                     case SDLK_RIGHT:    arrows[3] = key_down; break;
+                    case SDLK_s:        if (key_down) show_samples = !show_samples; break;
                 }
                 break;
             case SDL_MOUSEBUTTONDOWN:
@@ -100,30 +111,196 @@ static bool handle_events(uint32_t& iter, Camera& cam) {
     return false;
 }
 
-static void update_texture(uint32_t* buf, SDL_Texture* texture, size_t width, size_t height, uint32_t iter) {
+// Displays either the image or the number of samples per pixel, and returns the average number of samples per pixel
+static double update_texture(uint32_t* buf, SDL_Texture* texture, size_t width, size_t height, bool show_samples) {
     auto film = get_cpu_pixels();
-    auto inv_iter = 1.0f / iter;
+    auto counts = get_cpu_sample_counts();
+    auto max_count = std::max(*std::max_element(counts, counts + width * height), 1);
     auto gamma = 0.5f;
+    uint64_t total_count = 0;
     for (size_t y = 0; y < height; ++y) {
         for (size_t x = 0; x < width; ++x) {
             auto pixel = film[y * width + x];
+            auto count = counts[y * width + x];
+            total_count += count;
+
+            if (show_samples) {
+                // Sample map, from black (no samples) to white (most samples)
+                auto level = uint32_t(float(count) / float(max_count) * 255.0f);
+                buf[y * width + x] = (level << 16) | (level << 8) | level;
+                continue;
+            }
 
+            auto inv_count = count > 0 ? 1.0f / count : 0.0f;
             buf[y * width + x] =
-                (uint32_t(clamp(pow(pixel.r * inv_iter, gamma), 0.0f, 1.0f) * 255.0f) << 16) |
-                (uint32_t(clamp(pow(pixel.g * inv_iter, gamma), 0.0f, 1.0f) * 255.0f) << 8)  |
-                 uint32_t(clamp(pow(pixel.b * inv_iter, gamma), 0.0f, 1.0f) * 255.0f);
+                (uint32_t(clamp(pow(pixel.r * inv_count, gamma), 0.0f, 1.0f) * 255.0f) << 16) |
+                (uint32_t(clamp(pow(pixel.g * inv_count, gamma), 0.0f, 1.0f) * 255.0f) << 8)  |
+                 uint32_t(clamp(pow(pixel.b * inv_count, gamma), 0.0f, 1.0f) * 255.0f);
         }
     }
     SDL_UpdateTexture(texture, nullptr, buf, width * sizeof(uint32_t));
+    return double(total_count) / double(width * height);
+}
+
+// Rendering options that do not change between frames
+struct RenderOptions {
+    bool light_tracing = false;
+    int light_bvh_min_lights = 64;
+    bool tile_film = false;
+    bool watertight = false;
+    bool sort_shading = false;
+};
+
+static Settings make_settings(const Camera& cam, const RenderOptions& options) {
+    return Settings {
+        Vec3 { cam.eye.x, cam.eye.y, cam.eye.z },
+        Vec3 { cam.dir.x, cam.dir.y, cam.dir.z },
+        Vec3 { cam.up.x, cam.up.y, cam.up.z },
+        Vec3 { cam.right.x, cam.right.y, cam.right.z },
+        cam.w,
+        cam.h,
+        options.light_tracing,
+        options.light_bvh_min_lights,
+        options.tile_film,
+        options.watertight,
+        options.sort_shading
+    };
+}
+
+// Renders one frame and writes every ray traced by the eye tracer to a ray file
+static void capture_rays(const Camera& cam, const RenderOptions& options, const std::string& file) {
+    if (options.light_tracing)
+        warn("Light tracing does not support ray capture, the ray file will be empty.");
+    clear_cpu_film();
+    auto settings = make_settings(cam, options);
+    start_cpu_ray_capture();
+    render(&settings, 0);
+    finish_cpu_ray_capture(file);
+}
+
+// Renders the given number of frames without displaying them, and reports the time per frame
+static void benchmark(const Camera& cam, const RenderOptions& options, size_t width, size_t height, int frames) {
+    using Clock = std::chrono::high_resolution_clock;
+    clear_cpu_film();
+    auto settings = make_settings(cam, options);
+
+    // The first frame includes the texture loads and the first-touch page faults
+    render(&settings, 0);
+
+    auto start = Clock::now();
+    for (int i = 1; i <= frames; i++)
+        render(&settings, i);
+    auto ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / frames;
+
+    // With adaptive sampling, frames do not have the same number of samples
+    auto counts = get_cpu_sample_counts();
+    uint64_t total_count = 0;
+    for (size_t i = 0; i < width * height; i++) total_count += counts[i];
+    auto spp = double(total_count) / double(width * height);
+
+    info("Benchmark: ", frames, " frame(s), ", ms, " ms/frame, ", spp, " samples per pixel, ",
+         double(total_count) / (ms * frames * 1000.0), " Msamples/s (", options.tile_film ? "tile-local" : "direct", " film, ",
+         options.sort_shading ? "sorted" : "unsorted", " shading)");
 }
 
-static void clear_film(size_t width, size_t height) {
-    memset(get_cpu_pixels(), 0, sizeof(Color) * width * height);
+static inline void usage() {
+    std::cout << "Usage: rodent [options]\n"
+                 "Available options:\n"
+                 "  -h     --help              Shows this message\n"
+                 "         --scene file        Loads the scene file (meshes, materials, instances and camera)\n"
+                 "                             (defaults to the mesh 'data/cube.obj')\n"
+                 "         --assets manifest   Loads the assets listed in the manifest in parallel before rendering\n"
+                 "                             (one 'mesh file' or 'texture file' entry per line)\n"
+                 "         --target-error e    Relative error under which tiles stop receiving samples (0 disables adaptive sampling)\n"
+                 "         --light-tracing     Traces paths from the lights instead of the camera (faster on caustics)\n"
+                 "         --light-selector s  Selects lights with an alias table ('alias'), the light BVH ('bvh'), or the light BVH\n"
+                 "                             when the scene has many lights ('auto', the default)\n"
+                 "         --tile-film         Accumulates the samples of each tile in tile-local buffers instead of writing\n"
+                 "                             them directly into the film\n"
+                 "         --watertight        Uses the watertight ray-triangle test, so that no ray leaks through shared edges\n"
+                 "         --sort-shading      Sorts the hits of each tile by material before shading them\n"
+                 "         --bench frames      Renders the given number of frames without a window and reports the time per frame\n"
+                 "         --capture-rays file Renders one frame without a window and writes the primary, bounce and shadow rays\n"
+                 "                             to the ray file (masked by depth and kind, see tools/common/ray_file.h)\n";
 }
 
 int main(int argc, char** argv) {
     size_t width  = 1024;
     size_t height = 1024;
+    std::string assets;
+    std::string scene_file;
+    std::string ray_file;
+    int bench_frames = 0;
+    float target_error = 0.02f;
+    RenderOptions options;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+            usage();
+            return 0;
+        } else if (!strcmp(argv[i], "--assets") && i + 1 < argc) {
+            assets = argv[++i];
+        } else if (!strcmp(argv[i], "--scene") && i + 1 < argc) {
+            scene_file = argv[++i];
+        } else if (!strcmp(argv[i], "--target-error") && i + 1 < argc) {
+            target_error = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--light-tracing")) {
+            options.light_tracing = true;
+        } else if (!strcmp(argv[i], "--light-selector") && i + 1 < argc) {
+            auto selector = argv[++i];
+            if (!strcmp(selector, "alias"))
+                options.light_bvh_min_lights = std::numeric_limits<int>::max();
+            else if (!strcmp(selector, "bvh"))
+                options.light_bvh_min_lights = 0;
+            else if (strcmp(selector, "auto"))
+                error("Unknown light selector '", selector, "'.");
+        } else if (!strcmp(argv[i], "--tile-film")) {
+            options.tile_film = true;
+        } else if (!strcmp(argv[i], "--watertight")) {
+            options.watertight = true;
+        } else if (!strcmp(argv[i], "--sort-shading")) {
+            options.sort_shading = true;
+        } else if (!strcmp(argv[i], "--bench") && i + 1 < argc) {
+            bench_frames = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--capture-rays") && i + 1 < argc) {
+            ray_file = argv[++i];
+        } else {
+            error("Unknown option '", argv[i], "'.");
+        }
+    }
+
+    // The vertices of the BVH are only stored for the watertight test
+    setup_cpu_interface(width, height, target_error, options.watertight);
+    if (!assets.empty())
+        load_cpu_assets(assets);
+
+    scene::Camera scene_cam {
+        float3(0.0f, 0.0f, 10.0f),
+        float3(0.0f, 0.0f, -1.0f),
+        float3(0.0f, 1.0f, 0.0f),
+        60.0f
+    };
+    // The scene and the assets of the manifest are loaded before the first frame
+    load_cpu_scene(scene_file, scene_cam);
+
+    Camera cam(
+        scene_cam.eye,
+        scene_cam.dir,
+        scene_cam.up,
+        scene_cam.fov,
+        float(width) / float(height));
+
+    if (!ray_file.empty()) {
+        capture_rays(cam, options, ray_file);
+        cleanup_cpu_interface();
+        return 0;
+    }
+
+    if (bench_frames > 0) {
+        benchmark(cam, options, width, height, bench_frames);
+        cleanup_cpu_interface();
+        return 0;
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         error("Cannot initialize SDL.");
@@ -148,35 +325,20 @@ int main(int argc, char** argv) {
 
     std::unique_ptr<uint32_t> buf(new uint32_t[width * height]);
 
-    setup_cpu_interface(width, height);
-
-    Camera cam(
-        float3(0.0f, 0.0f, 10.0f),
-        float3(0.0f, 0.0f, -1.0f),
-        float3(0.0f, 1.0f, 0.0f),
-        60.0f,
-        float(width) / float(height));
-
-    float fov = 60.0f;
     bool done = false;
+    bool show_samples = false;
+    double spp = 0;
     uint64_t tick_counter = 0;
     uint32_t frames = 0;
     uint32_t iter = 0;
 
     while (!done) {
-        done = handle_events(iter, cam);
+        done = handle_events(iter, cam, show_samples);
 
         if (iter == 0)
-            clear_film(width, height);
+            clear_cpu_film();
 
-        Settings settings {
-            Vec3 { cam.eye.x, cam.eye.y, cam.eye.z },
-            Vec3 { cam.dir.x, cam.dir.y, cam.dir.z },
-            Vec3 { cam.up.x, cam.up.y, cam.up.z },
-            Vec3 { cam.right.x, cam.right.y, cam.right.z },
-            cam.w,
-            cam.h
-        };
+        auto settings = make_settings(cam, options);
 
         auto ticks = SDL_GetTicks();
         render(&settings, iter++);
@@ -185,13 +347,13 @@ int main(int argc, char** argv) {
         frames++;
         if (frames > 10 || tick_counter >= 5000) {
             std::ostringstream os;
-            os << "Rodent [" << double(frames) * 1000.0 / double(tick_counter) << " FPS, " << iter << " samples]";
+            os << "Rodent [" << double(frames) * 1000.0 / double(tick_counter) << " FPS, " << iter << " iterations, " << spp << " spp]";
             SDL_SetWindowTitle(window, os.str().c_str());
             frames = 0;
             tick_counter = 0;
         }
 
-        update_texture(buf.get(), texture, width, height, iter);
+        spp = update_texture(buf.get(), texture, width, height, show_samples);
         SDL_RenderClear(renderer);
         SDL_RenderCopy(renderer, texture, nullptr, nullptr);
         SDL_RenderPresent(renderer);
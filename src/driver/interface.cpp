@@ -1,15 +1,24 @@
 #include <unordered_map>
+#include <algorithm>
+#include <deque>
 #include <memory>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <chrono>
 #include <cstring>
 
 #include <anydsl_runtime.hpp>
-#include <png.h>
+#include <tbb/task_group.h>
+#include <tbb/enumerable_thread_specific.h>
 
 #include "interface.h"
 #include "load_obj.h"
+#include "scene_file.h"
+#include "texture_cache.h"
+#include "light_bvh.h"
 #include "bvh.h"
+#include "ray_file.h"
 
 // Triangle Meshes -----------------------------------------------------------------
 
@@ -76,20 +85,65 @@ static void compute_vertex_normals(const std::vector<uint32_t>& indices,
     }
 }
 
-static TriMesh load_tri_mesh(int32_t dev, std::string file_name, std::vector<Tri>& tris) {
-    static size_t mtl_offset = 0;
+// Mesh data on the host, before it is uploaded to the device
+struct MeshData {
+    std::vector<uint32_t> indices;
+    std::vector<float3>   normals;
+    std::vector<float3>   face_normals;
+    std::vector<float2>   texcoords;
+    std::vector<float>    uv_scales;
+    std::vector<int32_t>  light_ids;
+    std::vector<Tri>      tris;
+    std::vector<EmissiveTri> lights;
+    std::vector<std::string> materials;     // Names of the materials, indexed by the material indices
+    obj::MaterialLib mtl_lib;
+    std::string dir;                        // Directory of the OBJ file
+    size_t num_materials;
+};
+
+// Collects the triangles of a mesh that emit light, given the emission of each material
+static void collect_emissive_tris(MeshData& mesh, const std::vector<rgb>& emission) {
+    auto& indices = mesh.indices;
+    mesh.lights.clear();
+    mesh.light_ids.assign(indices.size() / 4, -1);
+    for (size_t i = 0; i < indices.size(); i += 4) {
+        auto& ke = emission[indices[i + 3]];
+        if (luminance(ke) <= 0.0f)
+            continue;
+
+        auto& tri = mesh.tris[i / 4];
+        auto& n   = mesh.face_normals[i / 4];
+        auto area = tri.area();
+        if (area <= 0.0f)
+            continue;
+
+        mesh.light_ids[i / 4] = mesh.lights.size();
+        mesh.lights.push_back(EmissiveTri {
+            Vec3 { tri.v0.x, tri.v0.y, tri.v0.z },
+            Vec3 { tri.v1.x, tri.v1.y, tri.v1.z },
+            Vec3 { tri.v2.x, tri.v2.y, tri.v2.z },
+            Vec3 { n.x, n.y, n.z },
+            Color { ke.x, ke.y, ke.z },
+            1.0f / area,
+            luminance(ke) * area * pi,
+            -1
+        });
+    }
+}
 
+// Parses an OBJ file. Material indices are local to the file. Can be called from several threads.
+static void parse_tri_mesh(const std::string& file_name, MeshData& mesh) {
     obj::File obj_file;
     if (!load_obj(file_name, obj_file)) {
         error("Cannot load file '", file_name, "'.");
         abort();
     }
 
-    std::vector<uint32_t> indices;
-    std::vector<float3>   vertices;
-    std::vector<float3>   normals;
-    std::vector<float3>   face_normals;
-    std::vector<float2>   texcoords;
+    auto& indices      = mesh.indices;
+    auto& normals      = mesh.normals;
+    auto& face_normals = mesh.face_normals;
+    auto& texcoords    = mesh.texcoords;
+    std::vector<float3> vertices;
 
     for (auto& obj: obj_file.objects) {
         // Convert the faces to triangles & build the new list of indices
@@ -115,7 +169,7 @@ static TriMesh load_tri_mesh(int32_t dev, std::string file_name, std::vector<Tri
 
                 for (int i = 1; i < face.index_count - 1; i++) {
                     auto next = mapping[face.indices[i + 1]];
-                    triangles.emplace_back(v0, prev, next, face.material + mtl_offset);
+                    triangles.emplace_back(v0, prev, next, face.material);
                     prev = next;
                 }
             }
@@ -175,24 +229,77 @@ static TriMesh load_tri_mesh(int32_t dev, std::string file_name, std::vector<Tri
         auto& v0 = vertices[indices[i + 0]];
         auto& v1 = vertices[indices[i + 1]];
         auto& v2 = vertices[indices[i + 2]];
-        tris.emplace_back(v0, v1, v2);
+        mesh.tris.emplace_back(v0, v1, v2);
     }
 
-    mtl_offset += obj_file.materials.size();
+    // Compute the ratio between the UV area and the area of each triangle, for mip-mapping
+    mesh.uv_scales.resize(indices.size() / 4);
+    for (size_t i = 0; i < indices.size(); i += 4) {
+        auto& v0 = vertices[indices[i + 0]];
+        auto& v1 = vertices[indices[i + 1]];
+        auto& v2 = vertices[indices[i + 2]];
+        auto  t1 = texcoords[indices[i + 1]] - texcoords[indices[i + 0]];
+        auto  t2 = texcoords[indices[i + 2]] - texcoords[indices[i + 0]];
+        auto area = length(cross(v1 - v0, v2 - v0));
+        auto uv_area = std::fabs(t1.x * t2.y - t1.y * t2.x);
+        mesh.uv_scales[i / 4] = area > 0.0f ? std::sqrt(uv_area / area) : 0.0f;
+    }
+
+    // Load the materials, and collect the triangles that have an emissive material
+    mesh.dir = FilePath(file_name).base_name();
+    for (auto& lib : obj_file.mtl_libs) {
+        if (!load_mtl(mesh.dir + "/" + lib, mesh.mtl_lib))
+            warn("Cannot load material library '", lib, "'.");
+    }
+
+    std::vector<rgb> emission;
+    for (auto& name : obj_file.materials) {
+        auto mtl = mesh.mtl_lib.find(name);
+        emission.push_back(mtl != mesh.mtl_lib.end() ? mtl->second.ke : rgb(0.0f));
+    }
+    collect_emissive_tris(mesh, emission);
+
+    mesh.materials = obj_file.materials;
+    mesh.num_materials = obj_file.materials.size();
 
     // Re-normalize all the values in the OBJ file to handle invalid meshes
     for (auto& n : normals)
         n = normalize(n);
+}
+
+// Uploads a parsed mesh to the device, and appends its triangles and its emissive triangles to the given lists.
+// Material indices are offset by the given value, and light indices by the number of lights already in the list.
+static TriMesh upload_tri_mesh(int32_t dev, const MeshData& mesh, int32_t mtl_offset, std::vector<Tri>& tris, std::vector<EmissiveTri>& lights) {
+    auto& normals      = mesh.normals;
+    auto& face_normals = mesh.face_normals;
+    auto& texcoords    = mesh.texcoords;
+    auto& uv_scales    = mesh.uv_scales;
+
+    auto indices = mesh.indices;
+    for (size_t i = 3; i < indices.size(); i += 4)
+        indices[i] += mtl_offset;
+
+    auto light_ids = mesh.light_ids;
+    for (auto& id : light_ids) {
+        if (id >= 0) id += lights.size();
+    }
+
+    tris.insert(tris.end(), mesh.tris.begin(), mesh.tris.end());
+    lights.insert(lights.end(), mesh.lights.begin(), mesh.lights.end());
 
     auto normals_ptr      = reinterpret_cast<Vec3*>(anydsl_alloc(dev, sizeof(Vec3) * normals.size()));
     auto face_normals_ptr = reinterpret_cast<Vec3*>(anydsl_alloc(dev, sizeof(Vec3) * face_normals.size()));
     auto uvs_ptr          = reinterpret_cast<Vec2*>(anydsl_alloc(dev, sizeof(Vec2) * texcoords.size()));
     auto ids_ptr          = reinterpret_cast<int32_t*>(anydsl_alloc(dev, sizeof(int32_t) * indices.size()));
+    auto uv_scales_ptr    = reinterpret_cast<float*>(anydsl_alloc(dev, sizeof(float) * uv_scales.size()));
+    auto light_ids_ptr    = reinterpret_cast<int32_t*>(anydsl_alloc(dev, sizeof(int32_t) * light_ids.size()));
 
     anydsl_copy(0, normals.data(),      0, dev, normals_ptr,      0, sizeof(Vec3)    * normals.size());
     anydsl_copy(0, face_normals.data(), 0, dev, face_normals_ptr, 0, sizeof(Vec3)    * face_normals.size());
     anydsl_copy(0, texcoords.data(),    0, dev, uvs_ptr,          0, sizeof(Vec2)    * texcoords.size());
     anydsl_copy(0, indices.data(),      0, dev, ids_ptr,          0, sizeof(int32_t) * indices.size());
+    anydsl_copy(0, uv_scales.data(),    0, dev, uv_scales_ptr,    0, sizeof(float)   * uv_scales.size());
+    anydsl_copy(0, light_ids.data(),    0, dev, light_ids_ptr,    0, sizeof(int32_t) * light_ids.size());
 
     int32_t num_tris = indices.size() / 4;
     return TriMesh {
@@ -200,112 +307,133 @@ static TriMesh load_tri_mesh(int32_t dev, std::string file_name, std::vector<Tri
         face_normals_ptr,
         uvs_ptr,
         ids_ptr,
+        uv_scales_ptr,
+        light_ids_ptr,
         num_tris
     };
 }
 
-static void release_tri_mesh(int32_t dev, TriMesh tri_mesh) {
-    anydsl_release(dev, const_cast<Vec3*>(tri_mesh.normals));
-    anydsl_release(dev, const_cast<Vec3*>(tri_mesh.face_normals));
-    anydsl_release(dev, const_cast<Vec2*>(tri_mesh.uvs));
-    anydsl_release(dev, const_cast<int32_t*>(tri_mesh.ids));
-}
-
-// Images --------------------------------------------------------------------------
-
-static void read_from_stream(png_structp png_ptr, png_bytep data, png_size_t length) {
-    png_voidp a = png_get_io_ptr(png_ptr);
-    ((std::istream*)a)->read((char*)data, length);
-}
-
-static bool load_png(int32_t dev, std::string file_name, PixelData& pixel_data) {
-    std::ifstream file(file_name, std::ifstream::binary);
-    if (!file)
-        return false;
-
-    // Read signature
-    char sig[8];
-    file.read(sig, 8);
-    if (!png_check_sig((unsigned char*)sig, 8))
-        return false;
+// Appends a copy of a mesh, transformed by the given 3x4 matrix, to another mesh. Material indices are remapped.
+static void append_instance(MeshData& dst, const MeshData& src, const float* m, const std::vector<int32_t>& mtl_map) {
+    auto transform_point = [m] (const float3& p) {
+        return float3(m[0] * p.x + m[1] * p.y + m[2]  * p.z + m[3],
+                      m[4] * p.x + m[5] * p.y + m[6]  * p.z + m[7],
+                      m[8] * p.x + m[9] * p.y + m[10] * p.z + m[11]);
+    };
 
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!png_ptr)
-        return false;
+    // Normals are transformed by the cofactor matrix, which is the inverse transpose up to a scaling factor
+    float3 r0(m[0], m[1], m[2]), r1(m[4], m[5], m[6]), r2(m[8], m[9], m[10]);
+    float3 c0 = cross(r1, r2), c1 = cross(r2, r0), c2 = cross(r0, r1);
+    auto transform_normal = [&] (const float3& n) {
+        return normalize(float3(dot(c0, n), dot(c1, n), dot(c2, n)));
+    };
 
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-        png_destroy_read_struct(&png_ptr, nullptr, nullptr);
-        return false;
+    auto vtx_offset = dst.normals.size();
+    for (size_t i = 0; i < src.indices.size(); i += 4) {
+        dst.indices.push_back(src.indices[i + 0] + vtx_offset);
+        dst.indices.push_back(src.indices[i + 1] + vtx_offset);
+        dst.indices.push_back(src.indices[i + 2] + vtx_offset);
+        dst.indices.push_back(mtl_map[src.indices[i + 3]]);
     }
 
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        return false;
-    }
+    for (auto& n : src.normals)
+        dst.normals.push_back(transform_normal(n));
+    for (auto& n : src.face_normals)
+        dst.face_normals.push_back(transform_normal(n));
+    dst.texcoords.insert(dst.texcoords.end(), src.texcoords.begin(), src.texcoords.end());
 
-    png_set_sig_bytes(png_ptr, 8);
-    png_set_read_fn(png_ptr, (png_voidp)&file, read_from_stream);
-    png_read_info(png_ptr, info_ptr);
+    for (size_t i = 0; i < src.tris.size(); i++) {
+        auto& tri = src.tris[i];
+        Tri new_tri(transform_point(tri.v0), transform_point(tri.v1), transform_point(tri.v2));
 
-    size_t width  = png_get_image_width(png_ptr, info_ptr);
-    size_t height = png_get_image_height(png_ptr, info_ptr);
+        // The ratio between the UV area and the area of the triangle changes with the area of the triangle
+        auto area = tri.area(), new_area = new_tri.area();
+        dst.uv_scales.push_back(new_area > 0.0f ? src.uv_scales[i] * std::sqrt(area / new_area) : 0.0f);
+        dst.tris.push_back(new_tri);
+    }
+}
 
-    png_uint_32 color_type = png_get_color_type(png_ptr, info_ptr);
-    png_uint_32 bit_depth  = png_get_bit_depth(png_ptr, info_ptr);
+static void release_tri_mesh(int32_t dev, TriMesh tri_mesh) {
+    anydsl_release(dev, const_cast<Vec3*>(tri_mesh.normals));
+    anydsl_release(dev, const_cast<Vec3*>(tri_mesh.face_normals));
+    anydsl_release(dev, const_cast<Vec2*>(tri_mesh.uvs));
+    anydsl_release(dev, const_cast<int32_t*>(tri_mesh.ids));
+    anydsl_release(dev, const_cast<float*>(tri_mesh.uv_scales));
+    anydsl_release(dev, const_cast<int32_t*>(tri_mesh.light_ids));
+}
 
-    // Expand paletted and grayscale images to RGB
-    if (color_type == PNG_COLOR_TYPE_PALETTE) {
-        png_set_palette_to_rgb(png_ptr);
-    } else if (color_type == PNG_COLOR_TYPE_GRAY ||
-               color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
-        png_set_gray_to_rgb(png_ptr);
+// Materials -----------------------------------------------------------------------
+
+// Converts an MTL material to one of the kinds of materials supported by the renderer
+static scene::Material convert_material(const obj::Material& mtl, const std::string& dir) {
+    scene::Material mat;
+    mat.ns = mtl.ns;
+    mat.ni = mtl.ni;
+    if (luminance(mtl.ke) > 0.0f) {
+        mat.kind  = scene::MATERIAL_EMISSIVE;
+        mat.color = mtl.ke;
+    } else if (mtl.illum == 4 || mtl.illum == 6 || mtl.illum == 7 || mtl.illum == 9 || mtl.d < 1.0f) {
+        mat.kind  = scene::MATERIAL_GLASS;
+        mat.color = luminance(mtl.tf) > 0.0f ? mtl.tf : rgb(1.0f);
+    } else if (mtl.illum == 3 || mtl.illum == 5) {
+        mat.kind  = scene::MATERIAL_MIRROR;
+        mat.color = mtl.ks;
+    } else if (luminance(mtl.ks) > luminance(mtl.kd) && mtl.ns > 0.0f) {
+        mat.kind  = scene::MATERIAL_GLOSSY;
+        mat.color = mtl.ks;
+        if (!mtl.map_ks.empty()) mat.texture = dir + "/" + mtl.map_ks;
+    } else {
+        mat.kind  = scene::MATERIAL_DIFFUSE;
+        mat.color = mtl.kd;
+        if (!mtl.map_kd.empty()) mat.texture = dir + "/" + mtl.map_kd;
     }
+    return mat;
+}
 
-    // Transform to 8 bit per channel
-    if (bit_depth == 16)
-        png_set_strip_16(png_ptr);
-
-    // Get alpha channel when there is one
-    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
-        png_set_tRNS_to_alpha(png_ptr);
+// Material used when a mesh refers to a material that is not defined
+static scene::Material default_material() {
+    scene::Material mat;
+    mat.kind  = scene::MATERIAL_DIFFUSE;
+    mat.color = rgb(0.5f);
+    mat.ns    = 0.0f;
+    mat.ni    = 1.0f;
+    return mat;
+}
 
-    // Otherwise add an opaque alpha channel
-    else
-        png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
+// Lights --------------------------------------------------------------------------
+
+// Builds an alias table to pick lights in proportion to their power, in constant time (Vose's method)
+static void build_alias_table(const std::vector<float>& powers, std::vector<LightAlias>& table) {
+    auto n = powers.size();
+    double total = 0;
+    for (auto power : powers)
+        total += power;
+
+    table.resize(n);
+    std::vector<double> scaled(n);
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; i++) {
+        table[i].pdf = total > 0 ? powers[i] / total : 1.0 / n;
+        scaled[i] = double(table[i].pdf) * n;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
 
-    std::vector<Color> pixels(width * height);
-    std::vector<png_byte> row_bytes(width * 4);
-    for (size_t y = 0; y < height; y++) {
-        png_read_row(png_ptr, row_bytes.data(), nullptr);
-        Color* img_row = pixels.data() + width * y;
-        for (size_t x = 0; x < width; x++) {
-            img_row[x].r = row_bytes[x * 4 + 0] / 255.0f;
-            img_row[x].g = row_bytes[x * 4 + 1] / 255.0f;
-            img_row[x].b = row_bytes[x * 4 + 2] / 255.0f;
+    while (!small.empty() && !large.empty()) {
+        auto s = small.back();
+        auto l = large.back();
+        small.pop_back();
+        table[s].prob  = scaled[s];
+        table[s].alias = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
         }
     }
 
-    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-
-    auto pixels_ptr = reinterpret_cast<Color*>(anydsl_alloc(dev, sizeof(Color) * width * height));
-    anydsl_copy(0, pixels.data(), 0, dev, pixels_ptr, 0, sizeof(Color) * width * height);
-
-    pixel_data.pixels = pixels_ptr;
-    pixel_data.width  = static_cast<int>(width);
-    pixel_data.height = static_cast<int>(height);
-    return true;
-}
-
-static PixelData load_image(int32_t dev, std::string file_name) {
-    PixelData image;
-    if (!load_png(dev, file_name, image))
-        error("Cannot load file '", file_name, "'.");
-    return image;
-}
-
-static void release_image(int32_t dev, PixelData pixel_data) {
-    anydsl_release(dev, const_cast<Color*>(pixel_data.pixels));
+    // The remaining entries are only off by rounding errors
+    for (auto i : small) table[i].prob = 1.0f, table[i].alias = i;
+    for (auto i : large) table[i].prob = 1.0f, table[i].alias = i;
 }
 
 // BVH -----------------------------------------------------------------------------
@@ -329,16 +457,18 @@ class Bvh8Tri4Adapter {
     using BvhBuilder = SplitBvhBuilder<8, CostFn>;
     using Adapter    = Bvh8Tri4Adapter;
 
-    std::vector<Bvh8Node>& nodes_;
-    std::vector<Bvh4Tri>&  tris_;
-    Stack<StackElem>       stack_;
-    BvhBuilder             builder_;
+    std::vector<Bvh8Node>&        nodes_;
+    std::vector<Bvh4Tri>&         tris_;
+    std::vector<Bvh4TriVertices>* verts_;
+    Stack<StackElem>              stack_;
+    BvhBuilder                    builder_;
 
     const Tri* in_tris;
 
 public:
-    Bvh8Tri4Adapter(std::vector<Bvh8Node>& nodes, std::vector<Bvh4Tri>& tris)
-        : nodes_(nodes), tris_(tris)
+    // The vertex packets are only written when verts is not null
+    Bvh8Tri4Adapter(std::vector<Bvh8Node>& nodes, std::vector<Bvh4Tri>& tris, std::vector<Bvh4TriVertices>* verts)
+        : nodes_(nodes), tris_(tris), verts_(verts)
     {}
 
     void build(const std::vector<Tri>& tris) {
@@ -369,6 +499,7 @@ private:
             if (!stack.is_empty()) {
                 StackElem elem = stack.pop();
                 nodes[elem.parent].child[elem.child] = i + 1;
+                nodes[i].parent = elem.parent + 1;
             }
 
             assert(count >= 2 && count <= 8);
@@ -436,6 +567,7 @@ private:
             auto& nodes = adapter.nodes_;
             auto& stack = adapter.stack_;
             auto& tris = adapter.tris_;
+            auto  verts = adapter.verts_;
             auto  in_tris = adapter.in_tris;
 
             if (stack.is_empty()) {
@@ -446,11 +578,14 @@ private:
                 nodes[elem.parent].child[elem.child] = ~tris.size();
             }
 
-            // Group triangles by packets of 4
+            // Group triangles by packets of 4. The vertex packets keep the exact vertices of the same triangles
+            // for the watertight test, since v0 - e1 and v0 + e2 are not exactly the vertices of the mesh.
             for (int i = 0; i < ref_count; i += 4) {
                 const int c = i + 4 <= ref_count ? 4 : ref_count - i;
                 Bvh4Tri bvh4tri;
-                memset(&bvh4tri, 0, sizeof(Bvh4Tri));
+                Bvh4TriVertices bvh4verts;
+                memset(&bvh4tri,   0, sizeof(Bvh4Tri));
+                memset(&bvh4verts, 0, sizeof(Bvh4TriVertices));
                 for (int j = 0; j < c; j++) {
                     const int id = refs(i + j);
                     const Tri& tri = in_tris[id];
@@ -474,15 +609,26 @@ private:
                     bvh4tri.n[2][j] = n.z;
 
                     bvh4tri.id[j] = id;
+
+                    for (int k = 0; k < 3; k++) {
+                        bvh4verts.v0[k][j] = tri.v0[k];
+                        bvh4verts.v1[k][j] = tri.v1[k];
+                        bvh4verts.v2[k][j] = tri.v2[k];
+                    }
                 }
 
                 for (int j = c; j < 4; j++)
                     bvh4tri.id[j] = 0xFFFFFFFF;
+                std::copy(bvh4tri.id, bvh4tri.id + 4, bvh4verts.id);
 
                 tris.emplace_back(bvh4tri);
+                if (verts)
+                    verts->emplace_back(bvh4verts);
             }
             assert(!tris.empty());
             tris.back().id[3] |= 0x80000000;
+            if (verts)
+                verts->back().id[3] |= 0x80000000;
         }
     };
 };
@@ -494,26 +640,36 @@ template <>
 struct BvhTraits<Bvh8Tri4> {
     using Node = Bvh8Node;
     using Tri  = Bvh4Tri;
+    using Vertices = Bvh4TriVertices;
     using Adapter = Bvh8Tri4Adapter;
 };
 
+// Builds the BVH, and when requested, the vertex packets of its triangles (in the same order) for the watertight test.
+// Otherwise, verts_ptr is set to null.
 template <typename BvhType>
-BvhType build_bvh(int32_t dev, const std::vector<Tri>& in_tris) {
+BvhType build_bvh(int32_t dev, const std::vector<Tri>& in_tris, bool with_vertices, typename BvhTraits<BvhType>::Vertices*& verts_ptr) {
     using Traits  = BvhTraits<BvhType>;
     using Adapter = typename Traits::Adapter;
     using Node = typename Traits::Node;
     using Tri  = typename Traits::Tri;
+    using Vertices = typename Traits::Vertices;
 
     std::vector<Node> nodes;
     std::vector<Tri>  tris;
-    Adapter adapter(nodes, tris);
+    std::vector<Vertices> verts;
+    Adapter adapter(nodes, tris, with_vertices ? &verts : nullptr);
     adapter.build(in_tris);
-    info("BVH built with ", nodes.size(), " node(s), ", tris.size(), " triangle(s)");
+    info("BVH built with ", nodes.size(), " node(s), ", tris.size(), " triangle(s)", with_vertices ? " and their vertices" : "");
 
     auto nodes_ptr = reinterpret_cast<Node*>(anydsl_alloc(dev, sizeof(Node) * nodes.size()));
     auto tris_ptr  = reinterpret_cast<Tri*> (anydsl_alloc(dev, sizeof(Tri)  * tris.size()));
     anydsl_copy(0, nodes.data(), 0, dev, nodes_ptr, 0, sizeof(Node) * nodes.size());
     anydsl_copy(0, tris.data(),  0, dev, tris_ptr,  0, sizeof(Tri)  * tris.size());
+    verts_ptr = nullptr;
+    if (with_vertices) {
+        verts_ptr = reinterpret_cast<Vertices*>(anydsl_alloc(dev, sizeof(Vertices) * verts.size()));
+        anydsl_copy(0, verts.data(), 0, dev, verts_ptr, 0, sizeof(Vertices) * verts.size());
+    }
 
     return BvhType {
         nodes_ptr,
@@ -526,31 +682,104 @@ BvhType build_bvh(int32_t dev, const std::vector<Tri>& in_tris) {
 template <typename BvhType>
 class Interface {
 public:
-    Interface(int32_t dev, size_t width, size_t height)
-        : dev_(dev), width_(width), height_(height)
+    // Adaptive sampling: every pixel gets min_samples samples in total before its error is trusted
+    // (one per iteration), after which noisy tiles get up to max_samples samples per iteration.
+    // The first is a total and the second a rate, which is why min_samples can exceed max_samples.
+    // Converged tiles still get one sample per pixel every revisit_period iterations.
+    static constexpr int32_t min_samples    = 8;
+    static constexpr int32_t max_samples    = 4;
+    static constexpr int32_t revisit_period = 16;
+
+    Interface(int32_t dev, size_t width, size_t height, float target_error, bool watertight)
+        : dev_(dev), width_(width), height_(height), target_error_(target_error), watertight_(watertight)
     {}
 
     ~Interface() {
         if (film_data_)
             anydsl_release(dev_, film_data_->pixels);
+        if (sample_stats_) {
+            anydsl_release(dev_, sample_stats_->moments);
+            anydsl_release(dev_, sample_stats_->counts);
+        }
         for (auto& tri_mesh : tri_meshes_)
             release_tri_mesh(dev_, tri_mesh.second);
-        for (auto& image : images_)
-            release_image(dev_, image.second);
+        if (scene_data_) {
+            release_tri_mesh(dev_, scene_data_->mesh);
+            anydsl_release(dev_, const_cast<MaterialData*>(scene_data_->materials));
+            anydsl_release(dev_, const_cast<TextureData*>(scene_data_->textures));
+        }
     }
 
-    PixelData image(const char* file) {
-        auto it = images_.find(file);
-        if (it != images_.end())
-            return it->second;
-        return images_[file] = load_image(dev_, file);
+    TextureData texture(const char* file) {
+        return texture_cache_.texture(file);
+    }
+
+    const uint32_t* texture_tile(int32_t id, int32_t tile) {
+        return texture_cache_.load_tile(id, tile);
     }
 
     TriMesh tri_mesh(const char* file) {
         auto it = tri_meshes_.find(file);
         if (it != tri_meshes_.end())
             return it->second;
-        return tri_meshes_[file] = load_tri_mesh(dev_, file, tris_);
+        if (bvh_ || light_bvh_)
+            warn("Mesh '", file, "' is not part of the scene and will not be part of the BVH.");
+        MeshData mesh;
+        auto parsed = parsed_meshes_.find(file);
+        if (parsed == parsed_meshes_.end()) {
+            parse_tri_mesh(file, mesh);
+        } else {
+            mesh = std::move(parsed->second);
+            parsed_meshes_.erase(parsed);
+        }
+
+        // The materials of the meshes loaded this way follow each other in a single table
+        auto tri_mesh = tri_meshes_[file] = upload_tri_mesh(dev_, mesh, mtl_offset_, tris_, lights_);
+        mtl_offset_ += mesh.num_materials;
+        return tri_mesh;
+    }
+
+    // Reads an asset manifest. The assets are loaded with the scene: the meshes are parsed in parallel, and meshes
+    // that the scene does not use are kept for tri_mesh(). Textures are decoded when the renderer first uses them.
+    void load_assets(const std::string& manifest) {
+        std::ifstream is(manifest);
+        if (!is)
+            error("Cannot open asset manifest '", manifest, "'.");
+
+        std::string line;
+        while (std::getline(is, line)) {
+            std::istringstream line_stream(line);
+            std::string type, file;
+            if (!(line_stream >> type) || type[0] == '#')
+                continue;
+            if (!(line_stream >> file))
+                error("Missing file name in asset manifest '", manifest, "'.");
+            if (type == "mesh")
+                asset_meshes_.push_back(file);
+            else if (type == "texture")
+                asset_textures_.push_back(file);
+            else
+                error("Unknown asset type '", type, "' in asset manifest '", manifest, "'.");
+        }
+    }
+
+    // Loads a scene file (or the default scene if the file name is empty), and returns true if it sets the camera
+    bool load_scene(const std::string& file, scene::Camera& camera) {
+        scene::File scene_file;
+        if (file.empty())
+            scene_file = default_scene_file();
+        else if (!load_scene_file(file, scene_file))
+            error("Cannot load scene file '", file, "'.");
+        build_scene(scene_file);
+        if (scene_file.has_camera)
+            camera = scene_file.camera;
+        return scene_file.has_camera;
+    }
+
+    SceneData scene() {
+        if (!scene_data_)
+            build_scene(default_scene_file());
+        return *scene_data_;
     }
 
     PixelData film_data() {
@@ -565,54 +794,448 @@ public:
         return *film_data_;
     }
 
+    SampleStats sample_stats() {
+        if (sample_stats_)
+            return *sample_stats_;
+        auto moments = anydsl_alloc(dev_, sizeof(float)   * width_ * height_);
+        auto counts  = anydsl_alloc(dev_, sizeof(int32_t) * width_ * height_);
+        sample_stats_.reset(new SampleStats {
+            reinterpret_cast<float*>(moments),
+            reinterpret_cast<int32_t*>(counts),
+            target_error_,
+            min_samples,
+            max_samples,
+            revisit_period
+        });
+        return *sample_stats_;
+    }
+
+    void clear_film() {
+        auto film = film_data();
+        auto stats = sample_stats();
+        memset(film.pixels,    0, sizeof(Color)   * width_ * height_);
+        memset(stats.moments,  0, sizeof(float)   * width_ * height_);
+        memset(stats.counts,   0, sizeof(int32_t) * width_ * height_);
+    }
+
     BvhType bvh() {
         if (bvh_)
             return *bvh_;
-        bvh_.reset(new BvhType(build_bvh<BvhType>(dev_, tris_)));
+        bvh_.reset(new BvhType(build_bvh<BvhType>(dev_, tris_, watertight_, bvh_vertices_)));
         std::vector<Tri>().swap(tris_);
         return *bvh_;
     }
 
+    // Exact vertices of the triangles of the BVH, in the same packets, for the watertight test (null when it is not used)
+    const typename BvhTraits<BvhType>::Vertices* bvh_vertices() {
+        bvh();
+        return bvh_vertices_;
+    }
+
+    LightBvh light_bvh() {
+        if (light_bvh_)
+            return *light_bvh_;
+
+        std::vector<LightBvhNode> nodes;
+        build_light_bvh(lights_, point_lights_, nodes);
+        info("Light BVH built with ", nodes.size(), " node(s), ", lights_.size(), " emissive triangle(s), ", point_lights_.size(), " point light(s)");
+
+        // Every array gets at least one entry, so that the loads of the renderer never go through an empty buffer
+        auto nodes_ptr  = reinterpret_cast<LightBvhNode*>  (anydsl_alloc(dev_, sizeof(LightBvhNode)   * std::max(nodes.size(),         size_t(1))));
+        auto tris_ptr   = reinterpret_cast<EmissiveTri*>   (anydsl_alloc(dev_, sizeof(EmissiveTri)    * std::max(lights_.size(),       size_t(1))));
+        auto points_ptr = reinterpret_cast<PointLightData*>(anydsl_alloc(dev_, sizeof(PointLightData) * std::max(point_lights_.size(), size_t(1))));
+        memset(nodes_ptr,  0, sizeof(LightBvhNode));
+        memset(tris_ptr,   0, sizeof(EmissiveTri));
+        memset(points_ptr, 0, sizeof(PointLightData));
+        anydsl_copy(0, nodes.data(),         0, dev_, nodes_ptr,  0, sizeof(LightBvhNode)   * nodes.size());
+        anydsl_copy(0, lights_.data(),       0, dev_, tris_ptr,   0, sizeof(EmissiveTri)    * lights_.size());
+        anydsl_copy(0, point_lights_.data(), 0, dev_, points_ptr, 0, sizeof(PointLightData) * point_lights_.size());
+
+        light_bvh_.reset(new LightBvh {
+            nodes_ptr,
+            tris_ptr,
+            points_ptr,
+            static_cast<int32_t>(lights_.size()),
+            static_cast<int32_t>(lights_.size() + point_lights_.size())
+        });
+        return *light_bvh_;
+    }
+
+    LightData lights() {
+        if (light_data_)
+            return *light_data_;
+
+        // The lights are shared with the light BVH
+        auto light_bvh = this->light_bvh();
+
+        // The alias table covers the emissive triangles first, then the point lights
+        std::vector<float> powers;
+        for (auto& light : lights_)
+            powers.push_back(light.power);
+        for (auto& light : point_lights_)
+            powers.push_back(luminance(rgb(light.color.r, light.color.g, light.color.b)));
+
+        std::vector<LightAlias> alias;
+        build_alias_table(powers, alias);
+        auto alias_ptr = reinterpret_cast<LightAlias*>(anydsl_alloc(dev_, sizeof(LightAlias) * std::max(alias.size(), size_t(1))));
+        memset(alias_ptr, 0, sizeof(LightAlias));
+        anydsl_copy(0, alias.data(), 0, dev_, alias_ptr, 0, sizeof(LightAlias) * alias.size());
+
+        light_data_.reset(new LightData {
+            light_bvh.tris,
+            light_bvh.points,
+            alias_ptr,
+            light_bvh.num_tris,
+            light_bvh.num_lights
+        });
+        return *light_data_;
+    }
+
 private:
-    std::unordered_map<std::string, PixelData> images_;
+    // Scene used when no scene file is given
+    static scene::File default_scene_file() {
+        scene::File scene_file;
+        scene_file.has_camera = false;
+        scene_file.meshes.emplace_back("cube", "data/cube.obj");
+        return scene_file;
+    }
+
+    // Builds a scene, with the assets of the manifest. Meshes are parsed in parallel. The textures of the materials are
+    // decoded in parallel while the mesh is uploaded and the BVHs are built, and the other textures of the manifest are
+    // only registered, so that they are never decoded unless the renderer touches them. All the instances are flattened
+    // into a single mesh, so that the whole scene is in one BVH.
+    void build_scene(const scene::File& scene_file) {
+        if (scene_data_)
+            error("Only one scene can be loaded.");
+
+        using Clock = std::chrono::high_resolution_clock;
+        auto elapsed_ms = [] (Clock::time_point from, Clock::time_point to) {
+            return std::chrono::duration<double, std::milli>(to - from).count();
+        };
+        auto sum = [] (const std::deque<double>& times) {
+            double total = 0;
+            for (auto t : times) total += t;
+            return total;
+        };
+        auto start = Clock::now();
+
+        // Registering the textures of the manifest only reads their header, which reports missing files early
+        for (auto& file : asset_textures_)
+            texture_cache_.texture(file);
+
+        // The meshes of the manifest that the scene does not use are parsed as well
+        std::vector<std::string> files;
+        for (auto& mesh : scene_file.meshes)
+            files.push_back(mesh.second);
+        for (auto& file : asset_meshes_) {
+            if (std::find(files.begin(), files.end(), file) == files.end())
+                files.push_back(file);
+        }
+        std::vector<MeshData> meshes(files.size());
+        std::deque<double> parse_times(files.size());
+        tbb::task_group mesh_group;
+        for (size_t i = 0; i < files.size(); i++) {
+            mesh_group.run([&, i] {
+                auto from = Clock::now();
+                parse_tri_mesh(files[i], meshes[i]);
+                parse_times[i] = elapsed_ms(from, Clock::now());
+            });
+        }
+        mesh_group.wait();
+        auto parsed = Clock::now();
+        for (size_t i = scene_file.meshes.size(); i < files.size(); i++)
+            parsed_meshes_[files[i]] = std::move(meshes[i]);
+        meshes.resize(scene_file.meshes.size());
+
+        // Materials are shared by name, and the scene file overrides the MTL files
+        std::vector<MaterialData> materials;
+        std::vector<TextureData> textures;
+        std::unordered_map<std::string, int32_t> material_ids, texture_ids;
+        auto texture_id = [&] (const std::string& file) {
+            if (file.empty())
+                return -1;
+            auto it = texture_ids.find(file);
+            if (it != texture_ids.end())
+                return it->second;
+            textures.push_back(texture_cache_.texture(file));
+            return texture_ids[file] = textures.size() - 1;
+        };
+        auto material_id = [&] (const MeshData& mesh, const std::string& name) {
+            auto it = material_ids.find(name);
+            if (it != material_ids.end())
+                return it->second;
+            auto scene_mat = scene_file.materials.find(name);
+            auto mtl = mesh.mtl_lib.find(name);
+            auto mat = scene_mat != scene_file.materials.end() ? scene_mat->second
+                     : mtl != mesh.mtl_lib.end() ? convert_material(mtl->second, mesh.dir)
+                     : default_material();
+            materials.push_back(MaterialData {
+                mat.kind,
+                texture_id(mat.texture),
+                Color { mat.color.x, mat.color.y, mat.color.z },
+                mat.ns,
+                mat.ni
+            });
+            return material_ids[name] = materials.size() - 1;
+        };
+
+        std::vector<std::vector<int32_t>> mtl_maps(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++) {
+            for (auto& name : meshes[i].materials)
+                mtl_maps[i].push_back(material_id(meshes[i], name));
+        }
+
+        // The textures of the materials are decoded while the rest of the scene is built, so that the first frame
+        // does not wait for them
+        auto decode_start = Clock::now();
+        std::deque<double> decode_times(textures.size());
+        tbb::task_group texture_group;
+        for (size_t i = 0; i < textures.size(); i++) {
+            texture_group.run([&, i] {
+                auto from = Clock::now();
+                texture_cache_.decode(textures[i].id);
+                decode_times[i] = elapsed_ms(from, Clock::now());
+            });
+        }
+
+        std::vector<std::pair<size_t, const float*>> instances;
+        std::vector<bool> is_instanced(meshes.size(), false);
+        for (auto& instance : scene_file.instances) {
+            size_t i = 0;
+            while (scene_file.meshes[i].first != instance.mesh) i++;
+            instances.emplace_back(i, instance.transform);
+            is_instanced[i] = true;
+        }
+        static const float identity[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+        for (size_t i = 0; i < meshes.size(); i++) {
+            if (!is_instanced[i])
+                instances.emplace_back(i, identity);
+        }
+
+        MeshData scene_mesh;
+        for (auto& instance : instances)
+            append_instance(scene_mesh, meshes[instance.first], instance.second, mtl_maps[instance.first]);
+        std::vector<MeshData>().swap(meshes);
+
+        // Emissive triangles are collected with the final materials
+        std::vector<rgb> emission(materials.size(), rgb(0.0f));
+        for (size_t i = 0; i < materials.size(); i++) {
+            if (materials[i].kind == scene::MATERIAL_EMISSIVE)
+                emission[i] = rgb(materials[i].color.r, materials[i].color.g, materials[i].color.b);
+        }
+        collect_emissive_tris(scene_mesh, emission);
+        for (auto& light : scene_file.lights) {
+            point_lights_.push_back(PointLightData {
+                Vec3 { light.pos.x, light.pos.y, light.pos.z },
+                Color { light.color.x, light.color.y, light.color.z },
+                -1
+            });
+        }
+        if (scene_mesh.lights.empty() && point_lights_.empty())
+            add_default_light(scene_mesh);
+        scene_mesh.num_materials = materials.size();
+        auto num_tris = scene_mesh.tris.size();
+        auto flattened = Clock::now();
+
+        // Material indices are already those of the scene table
+        auto tri_mesh = upload_tri_mesh(dev_, scene_mesh, 0, tris_, lights_);
+
+        auto materials_ptr = reinterpret_cast<MaterialData*>(anydsl_alloc(dev_, sizeof(MaterialData) * materials.size()));
+        auto textures_ptr  = reinterpret_cast<TextureData*> (anydsl_alloc(dev_, sizeof(TextureData)  * textures.size()));
+        anydsl_copy(0, materials.data(), 0, dev_, materials_ptr, 0, sizeof(MaterialData) * materials.size());
+        anydsl_copy(0, textures.data(),  0, dev_, textures_ptr,  0, sizeof(TextureData)  * textures.size());
+
+        scene_data_.reset(new SceneData {
+            tri_mesh,
+            materials_ptr,
+            textures_ptr,
+            static_cast<int32_t>(materials.size()),
+            static_cast<int32_t>(textures.size())
+        });
+
+        auto num_lights = lights_.size() + point_lights_.size();
+        auto uploaded = Clock::now();
+        bvh();
+        lights();
+        auto built = Clock::now();
+        texture_group.wait();
+        auto done = Clock::now();
+
+        info("Scene loaded in ", elapsed_ms(start, done), " ms: ",
+             instances.size(), " instance(s), ", num_tris, " triangle(s), ", materials.size(), " material(s), ",
+             textures.size(), " texture(s), ", num_lights, " light(s)");
+        info("    Parsing:     ", elapsed_ms(start, parsed), " ms (", sum(parse_times), " ms of work, ", files.size(), " mesh(es))");
+        info("    Flattening:  ", elapsed_ms(parsed, flattened), " ms");
+        info("    Upload:      ", elapsed_ms(flattened, uploaded), " ms");
+        info("    BVH build:   ", elapsed_ms(uploaded, built), " ms (including the light BVH)");
+        info("    Textures:    ", elapsed_ms(decode_start, done), " ms (", sum(decode_times), " ms of work, ", textures.size(),
+             " used by the materials, overlapping the upload and the BVH build)");
+        info("                 ", asset_textures_.size(), " in the manifest (the others are decoded on first use)");
+    }
+
+    // Scenes without any light would render black: they get a point light near the top of their bounding box
+    void add_default_light(const MeshData& mesh) {
+        auto bbox = BBox::empty();
+        for (auto& tri : mesh.tris)
+            bbox.extend(tri.v0).extend(tri.v1).extend(tri.v2);
+        if (mesh.tris.empty())
+            bbox = BBox(float3(0.0f));
+
+        // The power grows with the size of the scene, so that the irradiance stays the same
+        auto extents = bbox.max - bbox.min;
+        auto size = std::max(std::max(extents.x, extents.y), std::max(extents.z, 1e-3f));
+        auto power = 25.0f * size * size;
+        auto center = (bbox.min + bbox.max) * 0.5f;
+        point_lights_.push_back(PointLightData {
+            Vec3 { center.x, bbox.min.y + 0.9f * extents.y, center.z },
+            Color { power, power, power },
+            -1
+        });
+        warn("The scene has no light, a point light is added at (", center.x, ", ", bbox.min.y + 0.9f * extents.y, ", ", center.z, ").");
+    }
+
     std::unordered_map<std::string, TriMesh>   tri_meshes_;
+    std::unordered_map<std::string, MeshData>  parsed_meshes_;
+    std::vector<std::string> asset_meshes_, asset_textures_;
+    TextureCache texture_cache_;
     std::unique_ptr<PixelData> film_data_;
+    std::unique_ptr<SampleStats> sample_stats_;
     std::unique_ptr<BvhType> bvh_;
+    typename BvhTraits<BvhType>::Vertices* bvh_vertices_ = nullptr;
+    std::unique_ptr<LightBvh> light_bvh_;
+    std::unique_ptr<LightData> light_data_;
+    std::unique_ptr<SceneData> scene_data_;
     std::vector<Tri> tris_;
+    std::vector<EmissiveTri> lights_;
+    std::vector<PointLightData> point_lights_;
+    int32_t mtl_offset_ = 0;
     size_t width_, height_;
+    float target_error_;
+    bool watertight_;
     int32_t dev_;
 };
 
+// Ray Capture ---------------------------------------------------------------------
+
+struct CapturedRay {
+    float org_dir[6];
+    float tmin, tmax;
+    uint32_t mask;
+};
+
+// The rays are recorded per thread, since every tile traces its own packets
+static bool capturing_rays = false;
+static tbb::enumerable_thread_specific<std::vector<CapturedRay>> captured_rays;
+
+void start_cpu_ray_capture() {
+    for (auto& rays : captured_rays) rays.clear();
+    capturing_rays = true;
+}
+
+// Writes the captured rays to a ray file, with their extents and ray_capture_mask() as masks.
+// The rays of a thread stay in tracing order, but the threads are written one after the other.
+void finish_cpu_ray_capture(const std::string& file) {
+    capturing_rays = false;
+
+    std::ofstream os(file, std::ofstream::binary);
+    if (!os)
+        error("Cannot open ray file '", file, "'.");
+    RayFileWriter writer(os, 8, RayFileHeader::HAS_EXTENTS | RayFileHeader::HAS_MASKS);
+    for (auto& rays : captured_rays) {
+        for (auto& ray : rays)
+            writer.add_ray(ray.org_dir, ray.tmin, ray.tmax, ray.mask);
+        rays.clear();
+        rays.shrink_to_fit();
+    }
+    if (!writer.close())
+        error("Cannot write ray file '", file, "'.");
+    info(writer.ray_count(), " ray(s) captured to '", file, "'");
+}
+
 // CPU Interface -------------------------------------------------------------------
 
 static std::unique_ptr<Interface<Bvh8Tri4>> cpu_interface;
 
-void setup_cpu_interface(size_t width, size_t height) {
-    cpu_interface.reset(new Interface<Bvh8Tri4>(0, width, height));
+void setup_cpu_interface(size_t width, size_t height, float target_error, bool watertight) {
+    cpu_interface.reset(new Interface<Bvh8Tri4>(0, width, height, target_error, watertight));
 }
 
 Color* get_cpu_pixels() {
     return cpu_interface->film_data().pixels;
 }
 
+const int32_t* get_cpu_sample_counts() {
+    return cpu_interface->sample_stats().counts;
+}
+
+void clear_cpu_film() {
+    cpu_interface->clear_film();
+}
+
+void load_cpu_assets(const std::string& manifest) {
+    cpu_interface->load_assets(manifest);
+}
+
+bool load_cpu_scene(const std::string& file, scene::Camera& camera) {
+    return cpu_interface->load_scene(file, camera);
+}
+
 void cleanup_cpu_interface() {
     cpu_interface.reset();
 }
 
+extern "C" bool rodent_cpu_capture_rays() {
+    return capturing_rays;
+}
+
+extern "C" void rodent_cpu_capture_ray(float org_x, float org_y, float org_z,
+                                       float dir_x, float dir_y, float dir_z,
+                                       float tmin, float tmax, int32_t depth, bool any_hit) {
+    captured_rays.local().push_back(CapturedRay {
+        { org_x, org_y, org_z, dir_x, dir_y, dir_z },
+        tmin, tmax,
+        ray_capture_mask(depth, any_hit)
+    });
+}
+
 extern "C" void rodent_cpu_get_bvh8_tri4(Bvh8Tri4* bvh) {
     *bvh = cpu_interface->bvh();
 }
 
+extern "C" const Bvh4TriVertices* rodent_cpu_get_bvh8_tri4_vertices() {
+    return cpu_interface->bvh_vertices();
+}
+
 extern "C" void rodent_cpu_get_film_data(PixelData* film_data) {
     *film_data = cpu_interface->film_data();
 }
 
+extern "C" void rodent_cpu_get_sample_stats(SampleStats* sample_stats) {
+    *sample_stats = cpu_interface->sample_stats();
+}
+
 extern "C" void rodent_cpu_load_tri_mesh(const char* file, TriMesh* tri_mesh) {
     *tri_mesh = cpu_interface->tri_mesh(file);
 }
 
-extern "C" void rodent_cpu_load_pixel_data(const char* file, PixelData* pixel_data) {
-    *pixel_data = cpu_interface->image(file);
+extern "C" void rodent_cpu_get_scene(SceneData* scene_data) {
+    *scene_data = cpu_interface->scene();
+}
+
+extern "C" void rodent_cpu_get_lights(LightData* light_data) {
+    *light_data = cpu_interface->lights();
+}
+
+extern "C" void rodent_cpu_get_light_bvh(LightBvh* light_bvh) {
+    *light_bvh = cpu_interface->light_bvh();
+}
+
+extern "C" void rodent_cpu_load_texture(const char* file, TextureData* texture_data) {
+    *texture_data = cpu_interface->texture(file);
+}
+
+extern "C" const uint32_t* rodent_cpu_load_texture_tile(int32_t id, int32_t tile) {
+    return cpu_interface->texture_tile(id, tile);
 }
 
 // GPU Interface -------------------------------------------------------------------
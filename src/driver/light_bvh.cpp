@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cmath>
+
+#include "light_bvh.h"
+#include "common.h"
+#include "bbox.h"
+#include "color.h"
+
+// Emission angle around the normal (triangle lights are diffuse emitters)
+static constexpr float theta_e = pi / 2;
+
+// Cone that bounds the normals of a set of lights
+struct Cone {
+    float3 axis;
+    float theta_o;
+
+    Cone() {}
+    Cone(const float3& axis, float theta_o) : axis(axis), theta_o(theta_o) {}
+};
+
+struct LightRef {
+    BBox bbox;
+    float3 center;
+    Cone cone;
+    float power;
+    int32_t id;
+};
+
+struct LightCluster {
+    BBox bbox;
+    Cone cone;
+    float power;
+};
+
+static float3 to_float3(const Vec3& v) { return float3(v.x, v.y, v.z); }
+static Vec3 to_vec3(const float3& v) { return Vec3 { v.x, v.y, v.z }; }
+
+// Returns the smallest cone that contains the two given cones
+static Cone merge(Cone a, Cone b) {
+    if (a.theta_o < b.theta_o) std::swap(a, b);
+
+    auto theta_d = std::acos(clamp(dot(a.axis, b.axis), -1.0f, 1.0f));
+    if (std::min(theta_d + b.theta_o, pi) <= a.theta_o) return a;
+
+    auto theta_o = (a.theta_o + theta_d + b.theta_o) * 0.5f;
+    if (theta_o >= pi) return Cone(a.axis, pi);
+
+    // Rotate the axis of the widest cone towards the other one
+    auto ortho = b.axis - a.axis * std::cos(theta_d);
+    if (lensqr(ortho) < 1e-12f) return Cone(a.axis, pi);
+    auto theta_r = theta_o - a.theta_o;
+    return Cone(normalize(a.axis * std::cos(theta_r) + normalize(ortho) * std::sin(theta_r)), theta_o);
+}
+
+static LightCluster merge(const LightCluster& a, const LightCluster& b) {
+    return LightCluster { BBox(a.bbox).extend(b.bbox), merge(a.cone, b.cone), a.power + b.power };
+}
+
+// Measure of the set of directions in which the lights of a cluster emit
+// (Conty Estevez and Kulla, "Importance Sampling of Many Lights with Adaptive Tree Splitting")
+static float orientation_measure(const Cone& cone) {
+    auto theta_w = std::min(cone.theta_o + theta_e, pi);
+    auto cos_o = std::cos(cone.theta_o);
+    auto sin_o = std::sin(cone.theta_o);
+    return 2 * pi * (1 - cos_o) +
+           pi / 2 * (2 * theta_w * sin_o - std::cos(cone.theta_o - 2 * theta_w) - 2 * cone.theta_o * sin_o + cos_o);
+}
+
+static float cluster_cost(const LightCluster& cluster) {
+    return cluster.power * cluster.bbox.half_area() * orientation_measure(cluster.cone);
+}
+
+static LightCluster ref_cluster(const LightRef& ref) {
+    return LightCluster { ref.bbox, ref.cone, ref.power };
+}
+
+static LightBvhNode make_node(const LightCluster& cluster, int parent) {
+    LightBvhNode node;
+    node.min    = to_vec3(cluster.bbox.min);
+    node.power  = cluster.power;
+    node.max    = to_vec3(cluster.bbox.max);
+    node.cos_o  = std::cos(cluster.cone.theta_o);
+    node.axis   = to_vec3(cluster.cone.axis);
+    node.cos_e  = 0.0f;
+    node.child[0] = 0;
+    node.child[1] = 0;
+    node.parent = parent;
+    node.pad    = 0;
+    return node;
+}
+
+struct LightBvhBuilder {
+    std::vector<EmissiveTri>& tris;
+    std::vector<PointLightData>& points;
+    std::vector<LightBvhNode>& nodes;
+    std::vector<LightRef> refs;
+    std::vector<LightCluster> right;
+
+    LightBvhBuilder(std::vector<EmissiveTri>& tris, std::vector<PointLightData>& points, std::vector<LightBvhNode>& nodes)
+        : tris(tris), points(points), nodes(nodes)
+    {}
+
+    void set_parent(int id, int parent) {
+        if (id < int(tris.size()))
+            tris[id].node = parent;
+        else
+            points[id - tris.size()].node = parent;
+    }
+
+    // Builds the subtree for the given range of references, and returns the encoded index of its root
+    int build(int begin, int end, int parent) {
+        if (end - begin == 1) {
+            set_parent(refs[begin].id, parent);
+            return ~refs[begin].id;
+        }
+
+        // Find the split that minimizes the sum of the costs of both sides, along each axis
+        float best_cost = FLT_MAX;
+        int best_axis = -1, best_split = -1;
+        LightCluster cluster;
+        for (int axis = 0; axis < 3; axis++) {
+            sort_refs(begin, end, axis);
+
+            right[end - 1] = ref_cluster(refs[end - 1]);
+            for (int i = end - 2; i >= begin; i--)
+                right[i] = merge(ref_cluster(refs[i]), right[i + 1]);
+            cluster = right[begin];
+
+            auto left = ref_cluster(refs[begin]);
+            for (int i = begin + 1; i < end; i++) {
+                auto cost = cluster_cost(left) + cluster_cost(right[i]);
+                if (cost < best_cost) {
+                    best_cost  = cost;
+                    best_axis  = axis;
+                    best_split = i;
+                }
+                left = merge(left, ref_cluster(refs[i]));
+            }
+        }
+
+        // Degenerate clusters (e.g. lights with no power) are split in the middle
+        if (best_axis < 0 || !(best_cost > 0.0f)) {
+            auto extents = cluster.bbox.max - cluster.bbox.min;
+            best_axis  = extents.x > extents.y ? (extents.x > extents.z ? 0 : 2) : (extents.y > extents.z ? 1 : 2);
+            best_split = (begin + end) / 2;
+        }
+        if (best_axis != 2)
+            sort_refs(begin, end, best_axis);
+
+        int node = nodes.size();
+        nodes.emplace_back(make_node(cluster, parent));
+        auto left_child  = build(begin, best_split, node);
+        auto right_child = build(best_split, end, node);
+        nodes[node].child[0] = left_child;
+        nodes[node].child[1] = right_child;
+        return node;
+    }
+
+    void sort_refs(int begin, int end, int axis) {
+        std::sort(refs.begin() + begin, refs.begin() + end, [axis] (const LightRef& a, const LightRef& b) {
+            return a.center[axis] < b.center[axis];
+        });
+    }
+};
+
+void build_light_bvh(std::vector<EmissiveTri>& tris, std::vector<PointLightData>& points, std::vector<LightBvhNode>& nodes) {
+    nodes.clear();
+    auto num_lights = tris.size() + points.size();
+    if (num_lights == 0)
+        return;
+
+    LightBvhBuilder builder(tris, points, nodes);
+    builder.refs.resize(num_lights);
+    builder.right.resize(num_lights);
+    for (size_t i = 0; i < tris.size(); i++) {
+        auto& light = tris[i];
+        auto& ref = builder.refs[i];
+        ref.bbox   = BBox(to_float3(light.v0)).extend(to_float3(light.v1)).extend(to_float3(light.v2));
+        ref.center = (ref.bbox.min + ref.bbox.max) * 0.5f;
+        ref.cone   = Cone(to_float3(light.n), 0.0f);
+        ref.power  = light.power;
+        ref.id     = i;
+    }
+    for (size_t i = 0; i < points.size(); i++) {
+        // Point lights emit in all directions: their cone covers the whole sphere
+        auto& light = points[i];
+        auto& ref = builder.refs[tris.size() + i];
+        ref.bbox   = BBox(to_float3(light.pos));
+        ref.center = to_float3(light.pos);
+        ref.cone   = Cone(float3(0.0f, 0.0f, 1.0f), pi);
+        ref.power  = luminance(rgb(light.color.r, light.color.g, light.color.b));
+        ref.id     = tris.size() + i;
+    }
+
+    if (num_lights == 1) {
+        // The root is always an inner node
+        nodes.emplace_back(make_node(ref_cluster(builder.refs[0]), -1));
+        nodes[0].child[0] = ~0;
+        builder.set_parent(0, 0);
+        return;
+    }
+
+    builder.build(0, num_lights, -1);
+}
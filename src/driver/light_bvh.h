@@ -0,0 +1,14 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include <vector>
+
+#include "interface.h"
+
+/// Builds a binary BVH over the given emissive triangles and point lights, to select lights by importance.
+/// Every node stores the bounding box, the total power and a cone that bounds the normals of the lights below it.
+/// Each light is a leaf of the tree, and the node that references it is written back into the light.
+/// Leaves number the triangles first, followed by the point lights, which are leaves with no area.
+void build_light_bvh(std::vector<EmissiveTri>& tris, std::vector<PointLightData>& points, std::vector<LightBvhNode>& nodes);
+
+#endif // LIGHT_BVH_H
@@ -253,6 +253,19 @@ static bool parse_mtl(std::istream& stream, obj::MaterialLib& mtl_lib) {
                 error("Material redefinition for '", mtl_name, "' (line ", cur_line, ").");
                 err_count++;
             }
+
+            // Default values, for the terms that are not specified
+            auto& mat = current_material();
+            mat.ka = rgb(0.0f);
+            mat.kd = rgb(0.0f);
+            mat.ks = rgb(0.0f);
+            mat.ke = rgb(0.0f);
+            mat.ns = 0.0f;
+            mat.ni = 1.0f;
+            mat.tf = rgb(0.0f);
+            mat.tr = 0.0f;
+            mat.d  = 1.0f;
+            mat.illum = 0;
         } else if (ptr[0] == 'K') {
             if (ptr[1] == 'a' && std::isspace(ptr[2])) {
                 auto& mat = current_material();
@@ -0,0 +1,119 @@
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "common.h"
+#include "scene_file.h"
+
+static std::string resolve_path(const FilePath& scene_path, const std::string& file) {
+    return file.empty() || file[0] == '/' ? file : scene_path.base_name() + "/" + file;
+}
+
+static bool parse_material(std::istringstream& stream, const FilePath& path, scene::Material& mat) {
+    std::string kind;
+    if (!(stream >> kind >> mat.color.x >> mat.color.y >> mat.color.z))
+        return false;
+
+    mat.ns = 0.0f;
+    mat.ni = 1.0f;
+    if (kind == "diffuse") {
+        mat.kind = scene::MATERIAL_DIFFUSE;
+    } else if (kind == "glossy") {
+        mat.kind = scene::MATERIAL_GLOSSY;
+        if (!(stream >> mat.ns)) return false;
+    } else if (kind == "mirror") {
+        mat.kind = scene::MATERIAL_MIRROR;
+    } else if (kind == "glass") {
+        mat.kind = scene::MATERIAL_GLASS;
+        if (!(stream >> mat.ni)) return false;
+    } else if (kind == "emissive") {
+        mat.kind = scene::MATERIAL_EMISSIVE;
+    } else {
+        return false;
+    }
+
+    std::string texture;
+    if ((mat.kind == scene::MATERIAL_DIFFUSE || mat.kind == scene::MATERIAL_GLOSSY) && (stream >> texture))
+        mat.texture = resolve_path(path, texture);
+    return true;
+}
+
+bool load_scene_file(const FilePath& path, scene::File& scene_file) {
+    std::ifstream stream(path);
+    if (!stream)
+        return false;
+
+    scene_file.has_camera = false;
+
+    std::string line;
+    int cur_line = 0;
+    while (std::getline(stream, line)) {
+        cur_line++;
+
+        std::istringstream line_stream(line);
+        std::string cmd;
+        if (!(line_stream >> cmd) || cmd[0] == '#')
+            continue;
+
+        if (cmd == "camera") {
+            auto& cam = scene_file.camera;
+            if (!(line_stream >> cam.eye.x >> cam.eye.y >> cam.eye.z
+                              >> cam.dir.x >> cam.dir.y >> cam.dir.z
+                              >> cam.up.x  >> cam.up.y  >> cam.up.z
+                              >> cam.fov))
+                error("Invalid camera (line ", cur_line, ").");
+            scene_file.has_camera = true;
+        } else if (cmd == "mesh") {
+            std::string name, file;
+            if (!(line_stream >> name >> file))
+                error("Invalid mesh (line ", cur_line, ").");
+            auto same_name = [&] (const std::pair<std::string, std::string>& mesh) { return mesh.first == name; };
+            if (std::any_of(scene_file.meshes.begin(), scene_file.meshes.end(), same_name))
+                error("Mesh redefinition for '", name, "' (line ", cur_line, ").");
+            scene_file.meshes.emplace_back(name, resolve_path(path, file));
+        } else if (cmd == "instance") {
+            scene::Instance instance;
+            if (!(line_stream >> instance.mesh))
+                error("Invalid instance (line ", cur_line, ").");
+
+            // The transformation is optional, and defaults to the identity
+            std::vector<float> values;
+            float value;
+            while (line_stream >> value) values.push_back(value);
+            if (values.empty()) {
+                static const float identity[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+                std::copy(identity, identity + 12, instance.transform);
+            } else if (values.size() == 12) {
+                std::copy(values.begin(), values.end(), instance.transform);
+            } else {
+                error("Invalid transformation for instance of '", instance.mesh, "' (line ", cur_line, ").");
+            }
+            scene_file.instances.push_back(instance);
+        } else if (cmd == "material") {
+            std::string name;
+            scene::Material mat;
+            if (!(line_stream >> name) || !parse_material(line_stream, path, mat))
+                error("Invalid material (line ", cur_line, ").");
+            if (scene_file.materials.count(name))
+                error("Material redefinition for '", name, "' (line ", cur_line, ").");
+            scene_file.materials.emplace(name, mat);
+        } else if (cmd == "light") {
+            std::string kind;
+            scene::PointLight light;
+            if (!(line_stream >> kind) || kind != "point" ||
+                !(line_stream >> light.pos.x >> light.pos.y >> light.pos.z
+                              >> light.color.x >> light.color.y >> light.color.z))
+                error("Invalid light (line ", cur_line, ").");
+            scene_file.lights.push_back(light);
+        } else {
+            error("Unknown command '", cmd, "' (line ", cur_line, ").");
+        }
+    }
+
+    for (auto& instance : scene_file.instances) {
+        auto same_name = [&] (const std::pair<std::string, std::string>& mesh) { return mesh.first == instance.mesh; };
+        if (std::none_of(scene_file.meshes.begin(), scene_file.meshes.end(), same_name))
+            error("Unknown mesh '", instance.mesh, "' in instance.");
+    }
+    return true;
+}
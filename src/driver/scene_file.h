@@ -0,0 +1,72 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+#include "float3.h"
+#include "color.h"
+#include "file_path.h"
+
+namespace scene {
+
+/// Kinds of materials (must match the material_* constants in scene.impala).
+enum MaterialKind {
+    MATERIAL_DIFFUSE  = 0,
+    MATERIAL_GLOSSY   = 1,
+    MATERIAL_MIRROR   = 2,
+    MATERIAL_GLASS    = 3,
+    MATERIAL_EMISSIVE = 4
+};
+
+struct Material {
+    MaterialKind kind;          ///< Kind of material
+    rgb color;                  ///< Diffuse, specular, or emitted color, depending on the kind
+    float ns;                   ///< Phong exponent (glossy materials)
+    float ni;                   ///< Index of refraction (glass materials)
+    std::string texture;        ///< Texture that modulates the color (empty if none)
+};
+
+struct Camera {
+    float3 eye, dir, up;
+    float fov;                  ///< Horizontal field of view, in degrees
+};
+
+/// Instance of a mesh, with an affine transformation.
+struct Instance {
+    std::string mesh;           ///< Name of the mesh
+    float transform[12];        ///< Transformation matrix (3x4, row-major)
+};
+
+/// Point light, emitting the same power in all directions.
+struct PointLight {
+    float3 pos;
+    rgb color;                  ///< Emitted power
+};
+
+struct File {
+    bool has_camera;
+    Camera camera;
+    std::vector<std::pair<std::string, std::string>> meshes;    ///< Names and files of the meshes
+    std::vector<Instance> instances;                            ///< Instances (meshes that have none are placed as-is)
+    std::unordered_map<std::string, Material> materials;        ///< Materials, overriding the MTL materials with the same name
+    std::vector<PointLight> lights;                             ///< Lights, in addition to the emissive materials
+};
+
+} // namespace scene
+
+/// Loads a scene file. The format is line-based, with '#' comments:
+///     camera   eye-x eye-y eye-z dir-x dir-y dir-z up-x up-y up-z fov
+///     mesh     name file.obj
+///     instance name [m00 m01 m02 m03 m10 m11 m12 m13 m20 m21 m22 m23]
+///     material name diffuse  r g b [texture.png]
+///     material name glossy   r g b ns [texture.png]
+///     material name mirror   r g b
+///     material name glass    r g b ni
+///     material name emissive r g b
+///     light    point x y z r g b
+/// Relative file names are relative to the directory of the scene file.
+bool load_scene_file(const FilePath&, scene::File&);
+
+#endif // SCENE_FILE_H
@@ -0,0 +1,249 @@
+#include <fstream>
+#include <algorithm>
+
+#include <png.h>
+
+#include "texture_cache.h"
+#include "common.h"
+
+// PNG -----------------------------------------------------------------------------
+
+static void read_from_stream(png_structp png_ptr, png_bytep data, png_size_t length) {
+    png_voidp a = png_get_io_ptr(png_ptr);
+    ((std::istream*)a)->read((char*)data, length);
+}
+
+// Loads a PNG file as 8-bit RGBA pixels. Only reads the header when pixels is null.
+static bool load_png(const std::string& file_name, int& width, int& height, std::vector<uint32_t>* pixels) {
+    std::ifstream file(file_name, std::ifstream::binary);
+    if (!file)
+        return false;
+
+    // Read signature
+    char sig[8];
+    file.read(sig, 8);
+    if (!png_check_sig((unsigned char*)sig, 8))
+        return false;
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png_ptr)
+        return false;
+
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_read_struct(&png_ptr, nullptr, nullptr);
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return false;
+    }
+
+    png_set_sig_bytes(png_ptr, 8);
+    png_set_read_fn(png_ptr, (png_voidp)&file, read_from_stream);
+    png_read_info(png_ptr, info_ptr);
+
+    width  = png_get_image_width(png_ptr, info_ptr);
+    height = png_get_image_height(png_ptr, info_ptr);
+
+    if (!pixels) {
+        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+        return true;
+    }
+
+    png_uint_32 color_type = png_get_color_type(png_ptr, info_ptr);
+    png_uint_32 bit_depth  = png_get_bit_depth(png_ptr, info_ptr);
+
+    // Expand paletted and grayscale images to RGB
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    } else if (color_type == PNG_COLOR_TYPE_GRAY ||
+               color_type == PNG_COLOR_TYPE_GRAY_ALPHA) {
+        png_set_gray_to_rgb(png_ptr);
+    }
+
+    // Transform to 8 bit per channel
+    if (bit_depth == 16)
+        png_set_strip_16(png_ptr);
+
+    // Get alpha channel when there is one
+    if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+        png_set_tRNS_to_alpha(png_ptr);
+
+    // Otherwise add an opaque alpha channel
+    else
+        png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
+
+    // Rows are read directly as little-endian RGBA words
+    pixels->resize(size_t(width) * size_t(height));
+    for (int y = 0; y < height; y++)
+        png_read_row(png_ptr, (png_bytep)(pixels->data() + size_t(width) * y), nullptr);
+
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    return true;
+}
+
+// Texture cache -------------------------------------------------------------------
+
+static int mip_size(int size, int level) {
+    return std::max(size >> level, 1);
+}
+
+static int tiles_per_row(int width) {
+    return (width + TextureCache::tile_size - 1) >> TextureCache::tile_log2;
+}
+
+// Filter taps that reduce a row (or column) of the given size to the next mip level, for the given texel.
+// Even sizes use a box filter. Odd sizes use a 3-tap filter whose weights follow the footprint of each
+// texel, so that the last row (or column) is not dropped. Returns the number of taps.
+static int mip_taps(int size, int i, int* taps, float* weights) {
+    if (size == 1) {
+        taps[0] = 0;
+        weights[0] = 1.0f;
+        return 1;
+    }
+    if (size % 2 == 0) {
+        taps[0] = 2 * i;
+        taps[1] = 2 * i + 1;
+        weights[0] = weights[1] = 0.5f;
+        return 2;
+    }
+    auto n = size / 2;
+    auto inv_size = 1.0f / float(size);
+    taps[0] = 2 * i;
+    taps[1] = 2 * i + 1;
+    taps[2] = 2 * i + 2;
+    weights[0] = float(n - i) * inv_size;
+    weights[1] = float(n) * inv_size;
+    weights[2] = float(i + 1) * inv_size;
+    return 3;
+}
+
+// Computes the weighted sum of the given pixels, channel by channel
+static uint32_t filter_rgba8(const uint32_t* pixels, int w,
+                             const int* xs, const float* wxs, int nx,
+                             const int* ys, const float* wys, int ny) {
+    float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int j = 0; j < ny; j++) {
+        for (int i = 0; i < nx; i++) {
+            auto pixel = pixels[ys[j] * w + xs[i]];
+            auto weight = wxs[i] * wys[j];
+            for (int k = 0; k < 4; k++)
+                sum[k] += weight * float((pixel >> (8 * k)) & 0xFF);
+        }
+    }
+    uint32_t res = 0;
+    for (int k = 0; k < 4; k++)
+        res |= uint32_t(std::min(sum[k] + 0.5f, 255.0f)) << (8 * k);
+    return res;
+}
+
+TextureData TextureCache::texture(const std::string& file) {
+    // Decoding tasks and the renderer may be looking up other textures
+    std::unique_lock<std::mutex> lock(textures_mutex_);
+    auto it = ids_.find(file);
+    if (it == ids_.end()) {
+        // The header is read without holding the lock
+        lock.unlock();
+        std::unique_ptr<Texture> texture(new Texture());
+        texture->file = file;
+        if (!load_png(file, texture->width, texture->height, nullptr))
+            error("Cannot load file '", file, "'.");
+
+        texture->num_levels = 1;
+        while (std::max(texture->width, texture->height) >> texture->num_levels) texture->num_levels++;
+        texture->offsets.resize(texture->num_levels + 1);
+        texture->offsets[0] = 0;
+        for (int i = 0; i < texture->num_levels; i++) {
+            auto w = mip_size(texture->width, i), h = mip_size(texture->height, i);
+            texture->offsets[i + 1] = texture->offsets[i] + tiles_per_row(w) * tiles_per_row(h);
+        }
+
+        auto num_tiles = texture->offsets.back();
+        texture->tiles.reset(new std::atomic<int64_t>[num_tiles]);
+        for (int i = 0; i < num_tiles; i++)
+            texture->tiles[i] = 0;
+
+        // Another thread may have registered the same file in the meantime
+        lock.lock();
+        it = ids_.find(file);
+        if (it == ids_.end()) {
+            it = ids_.emplace(file, textures_.size()).first;
+            textures_.emplace_back(std::move(texture));
+        }
+    }
+
+    auto& texture = *textures_[it->second];
+    return TextureData {
+        reinterpret_cast<int64_t*>(texture.tiles.get()),
+        texture.offsets.data(),
+        it->second,
+        texture.width,
+        texture.height,
+        texture.num_levels
+    };
+}
+
+const uint32_t* TextureCache::load_tile(int32_t id, int32_t tile) {
+    auto& texture = registered(id);
+    auto addr = texture.tiles[tile].load(std::memory_order_acquire);
+    if (!addr) {
+        decode(texture);
+        addr = texture.tiles[tile].load(std::memory_order_acquire);
+    }
+    return reinterpret_cast<const uint32_t*>(addr);
+}
+
+void TextureCache::decode(Texture& texture) {
+    std::lock_guard<std::mutex> lock(texture.mutex);
+    if (texture.texels)
+        return;
+
+    int width, height;
+    std::vector<uint32_t> pixels;
+    if (!load_png(texture.file, width, height, &pixels))
+        error("Cannot load file '", texture.file, "'.");
+
+    const size_t tile_texels = tile_size * tile_size;
+    const size_t num_tiles = texture.offsets.back();
+    texture.texels.reset(new uint32_t[num_tiles * tile_texels]);
+    std::fill(texture.texels.get(), texture.texels.get() + num_tiles * tile_texels, 0);
+
+    std::vector<uint32_t> next;
+    for (int level = 0; level < texture.num_levels; level++) {
+        auto w = mip_size(texture.width, level), h = mip_size(texture.height, level);
+
+        // Scatter the pixels of this level into tiles, in Morton order
+        auto tiles_x = tiles_per_row(w);
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                auto tile = texture.offsets[level] + (y >> tile_log2) * tiles_x + (x >> tile_log2);
+                auto morton = pdep(x & (tile_size - 1), 0x55555555) | pdep(y & (tile_size - 1), 0xAAAAAAAA);
+                texture.texels[tile * tile_texels + morton] = pixels[y * w + x];
+            }
+        }
+
+        if (level + 1 == texture.num_levels) break;
+
+        // Build the next level with a box filter (3 taps along odd dimensions)
+        auto next_w = mip_size(w, 1), next_h = mip_size(h, 1);
+        next.resize(next_w * next_h);
+        for (int y = 0; y < next_h; y++) {
+            int ys[3];
+            float wys[3];
+            auto ny = mip_taps(h, y, ys, wys);
+            for (int x = 0; x < next_w; x++) {
+                int xs[3];
+                float wxs[3];
+                auto nx = mip_taps(w, x, xs, wxs);
+                next[y * next_w + x] = filter_rgba8(pixels.data(), w, xs, wxs, nx, ys, wys, ny);
+            }
+        }
+        std::swap(pixels, next);
+    }
+
+    for (size_t i = 0; i < num_tiles; i++)
+        texture.tiles[i].store(reinterpret_cast<int64_t>(texture.texels.get() + i * tile_texels), std::memory_order_release);
+    resident_bytes_ += num_tiles * tile_texels * sizeof(uint32_t);
+}
@@ -0,0 +1,56 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+#include "interface.h"
+
+/// Cache of mip-mapped textures, stored as 8-bit RGBA tiles.
+/// Textures are registered without being decoded: the file is only decoded, and its mip pyramid built,
+/// when it is requested with decode(), or when one of its tiles is touched for the first time.
+class TextureCache {
+public:
+    /// Size of a tile, on each side (must match texture_tile_log2 in image.impala).
+    static constexpr int tile_log2 = 5;
+    static constexpr int tile_size = 1 << tile_log2;
+
+    /// Registers a texture (only reads its header) and returns its description.
+    /// Can be called while other textures are being decoded.
+    TextureData texture(const std::string& file);
+    /// Makes the given tile resident and returns its texels (thread-safe).
+    const uint32_t* load_tile(int32_t id, int32_t tile);
+    /// Decodes a registered texture ahead of its first use, if it is not decoded yet (thread-safe).
+    void decode(int32_t id) { decode(registered(id)); }
+
+    /// Returns the number of bytes used by the resident tiles.
+    size_t resident_bytes() const { return resident_bytes_; }
+
+private:
+    struct Texture {
+        std::string file;
+        int width, height, num_levels;
+        std::vector<int32_t> offsets;
+        std::unique_ptr<std::atomic<int64_t>[]> tiles;
+        std::unique_ptr<uint32_t[]> texels;
+        std::mutex mutex;
+    };
+
+    void decode(Texture& texture);
+    Texture& registered(int32_t id) {
+        std::lock_guard<std::mutex> lock(textures_mutex_);
+        return *textures_[id];
+    }
+
+    std::unordered_map<std::string, int32_t> ids_;
+    std::vector<std::unique_ptr<Texture>> textures_;
+    std::mutex textures_mutex_;                         ///< Guards ids_ and textures_ between registrations and loads
+    std::atomic<size_t> resident_bytes_ { 0 };
+};
+
+#endif // TEXTURE_CACHE_H
@@ -17,6 +17,7 @@
 #include "traversal.h"
 #include "load_obj.h"
 #include "load_rays.h"
+#include "hit_file.h"
 #include "tri.h"
 
 template <>
@@ -78,7 +79,8 @@ inline void usage() {
                  "  -any                       Exit at the first intersection (disabled by default)\n"
                  "  -s       --single          Use single rays (disabled by default)\n"
                  "  -w       --bvh-width       Sets the BVH width (4 or 8, default: 4)\n"
-                 "  -o       --output          Sets the output file name (no file is generated by default)\n";
+                 "  -o       --output          Sets the output file name (no file is generated by default)\n"
+                 "  -hits    --hit-file        Writes the full hits to the given file, for comparison with hitdiff (disabled by default)\n";
 }
 
 static void create_triangles(const obj::File& obj_file, std::vector<Tri>& tris) {
@@ -187,6 +189,11 @@ void bench(int N, const std::vector<Tri>& tris,
 
     size_t intr = count_hits();
 
+    // Timings of every iteration, in order, for statistical analysis
+    std::cout << "# Timings (ms):";
+    for (auto t : timings) std::cout << " " << t;
+    std::cout << std::endl;
+
     std::sort(timings.begin(), timings.end());
     auto sum = std::accumulate(timings.begin(), timings.end(), 0.0);
     auto avg = sum / timings.size();
@@ -207,6 +214,7 @@ int main(int argc, char** argv) {
     std::string ray_file;
     std::string obj_file;
     std::string out_file;
+    std::string hit_file;
     float tmin = 0.0f, tmax = 1e9f;
     int iters = 1;
     int warmup = 0;
@@ -248,6 +256,9 @@ int main(int argc, char** argv) {
             } else if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
                 check_argument(i, argc, argv);
                 out_file = argv[++i];
+            } else if (!strcmp(arg, "-hits") || !strcmp(arg, "--hit-file")) {
+                check_argument(i, argc, argv);
+                hit_file = argv[++i];
             } else {
                 std::cerr << "Unknown option '" << arg << "'" << std::endl;
                 return 1;
@@ -289,9 +300,10 @@ int main(int argc, char** argv) {
 
     std::function<double(RTCScene)> iter_fn;
     std::function<size_t()> count_hits;
+    RayFileInfo ray_info;
 
     if (single_ray) {
-        if (!load_rays(ray_file, rays1, tmin, tmax, false)) {
+        if (!load_rays(ray_file, rays1, tmin, tmax, false, &ray_info)) {
             std::cerr << "Cannot load rays" << std::endl;
             return 1;
         }
@@ -304,7 +316,7 @@ int main(int argc, char** argv) {
             return intr; 
         };
     } else {
-        if (!load_rays(ray_file, rays8, tmin, tmax, false)) {
+        if (!load_rays(ray_file, rays8, tmin, tmax, false, &ray_info)) {
             std::cerr << "Cannot load rays" << std::endl;
             return 1;
         }
@@ -337,5 +349,27 @@ int main(int argc, char** argv) {
         }
     }
 
+    if (hit_file != "") {
+        // Occlusion queries only set geomID, and the padding of the last packet is not part of the results
+        std::vector<HitRecord> hit_records;
+        auto add_hit = [&] (unsigned geom_id, unsigned prim_id, float t, float u, float v) {
+            auto tri_id = geom_id == RTC_INVALID_GEOMETRY_ID ? -1 : any_hit ? 0 : int32_t(prim_id);
+            hit_records.push_back(HitRecord { tri_id, t, u, v });
+        };
+        if (single_ray) {
+            for (auto& hit : hits1) add_hit(hit.geomID, hit.primID, hit.tfar, hit.u, hit.v);
+        } else {
+            for (auto& hit : hits8) {
+                for (int i = 0; i < 8; i++)
+                    add_hit(hit.geomID[i], hit.primID[i], hit.tfar[i], hit.u[i], hit.v[i]);
+            }
+        }
+        hit_records.resize(std::min(hit_records.size(), ray_info.ray_count));
+        if (!write_hits(hit_file, hit_records, any_hit)) {
+            std::cerr << "Cannot write hit file" << std::endl;
+            return 1;
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,159 @@
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <random>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+
+#include <anydsl_runtime.hpp>
+
+#include "sort.h"
+
+inline void check_argument(int i, int argc, char** argv) {
+    if (i + 1 >= argc) {
+        std::cerr << "Missing argument for " << argv[i] << std::endl;
+        exit(1);
+    }
+}
+
+inline void usage() {
+    std::cout << "Usage: bench_sort [options]\n"
+                 "Available options:\n"
+                 "  -n       --count           Sets the number of keys to sort (default: 16777216)\n"
+                 "  -bits                      Sets the number of random bits in each key (default: all)\n"
+                 "  -seed                      Sets the seed of the random number generator (default: 42)\n"
+                 "  -bench   --bench-iters     Sets the number of benchmark iterations (default: 1)\n"
+                 "  -warmup  --bench-warmup    Sets the number of warmup iterations (default: 0)\n"
+                 "  -64                        Uses 64-bit keys (disabled by default)\n";
+}
+
+template <typename Key>
+struct RadixSort {};
+
+template <>
+struct RadixSort<uint32_t> {
+    static void sort(uint32_t* keys, uint32_t* values, size_t n) { cpu_radix_sort_u32(keys, values, n); }
+};
+
+template <>
+struct RadixSort<uint64_t> {
+    static void sort(uint64_t* keys, uint32_t* values, size_t n) { cpu_radix_sort_u64(keys, values, n); }
+};
+
+template <typename Key>
+static bool bench_sort(size_t n, int bits, uint64_t seed, int iters, int warmup) {
+    std::mt19937_64 gen(seed);
+    auto mask = bits >= int(sizeof(Key) * 8) ? Key(-1) : (Key(1) << bits) - 1;
+    std::vector<Key> input_keys(n);
+    for (auto& key : input_keys) key = Key(gen()) & mask;
+
+    std::vector<Key> keys(n);
+    std::vector<uint32_t> values(n);
+    std::vector<std::pair<Key, uint32_t>> pairs(n);
+
+    std::function<double()> bench_radix = [&] {
+        std::copy(input_keys.begin(), input_keys.end(), keys.begin());
+        std::iota(values.begin(), values.end(), 0);
+        auto t0 = anydsl_get_micro_time();
+        RadixSort<Key>::sort(keys.data(), values.data(), n);
+        auto t1 = anydsl_get_micro_time();
+        return (t1 - t0) / 1000.0;
+    };
+    std::function<double()> bench_std = [&] {
+        for (size_t i = 0; i < n; i++) pairs[i] = std::make_pair(input_keys[i], uint32_t(i));
+        auto t0 = anydsl_get_micro_time();
+        std::sort(pairs.begin(), pairs.end(), [] (const std::pair<Key, uint32_t>& a, const std::pair<Key, uint32_t>& b) {
+            return a.first < b.first;
+        });
+        auto t1 = anydsl_get_micro_time();
+        return (t1 - t0) / 1000.0;
+    };
+
+    auto run = [&] (const char* name, std::function<double()> bench) {
+        for (int i = 0; i < warmup; i++) bench();
+
+        std::vector<double> timings;
+        for (int i = 0; i < iters; i++)
+            timings.push_back(bench());
+
+        std::sort(timings.begin(), timings.end());
+        auto sum = std::accumulate(timings.begin(), timings.end(), 0.0);
+        std::cout << name << ": " << sum << "ms for " << iters << " iteration(s)" << std::endl;
+        std::cout << name << ": " << n * iters / (1000.0 * sum) << " Mkeys/sec" << std::endl;
+        std::cout << "# Average: " << sum / timings.size() << " ms" << std::endl;
+        std::cout << "# Median: " << timings[timings.size() / 2] << " ms" << std::endl;
+        std::cout << "# Min: " << timings.front() << " ms" << std::endl;
+    };
+
+    run("radix_sort", bench_radix);
+    run("std::sort", bench_std);
+
+    // The radix sort is stable, which means that the values must be increasing for equal keys
+    for (size_t i = 0; i < n; i++) {
+        if (keys[i] != pairs[i].first || input_keys[values[i]] != keys[i] ||
+            (i > 0 && keys[i - 1] == keys[i] && values[i - 1] >= values[i])) {
+            std::cerr << "Sorted keys differ at index " << i << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    size_t n = 1 << 24;
+    int bits = 64;
+    uint64_t seed = 42;
+    int iters = 1;
+    int warmup = 0;
+    bool use_u64 = false;
+
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (arg[0] == '-') {
+            if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+                usage();
+                return 0;
+            } else if (!strcmp(arg, "-n") || !strcmp(arg, "--count")) {
+                check_argument(i, argc, argv);
+                n = strtoul(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-bits")) {
+                check_argument(i, argc, argv);
+                bits = strtol(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-seed")) {
+                check_argument(i, argc, argv);
+                seed = strtoull(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-bench") || !strcmp(arg, "--bench-iters")) {
+                check_argument(i, argc, argv);
+                iters = strtol(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-warmup") || !strcmp(arg, "--bench-warmup")) {
+                check_argument(i, argc, argv);
+                warmup = strtol(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-64")) {
+                use_u64 = true;
+            } else {
+                std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Invalid argument '" << arg << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    if (n == 0 || n > size_t(INT32_MAX)) {
+        std::cerr << "Invalid number of keys" << std::endl;
+        return 1;
+    }
+    if (bits <= 0 || iters <= 0) {
+        std::cerr << "Invalid benchmark parameters" << std::endl;
+        return 1;
+    }
+
+    std::cout << n << " " << (use_u64 ? 64 : 32) << "-bit key(s) with 32-bit values." << std::endl;
+    bool ok = use_u64
+        ? bench_sort<uint64_t>(n, bits, seed, iters, warmup)
+        : bench_sort<uint32_t>(n, bits, seed, iters, warmup);
+    return ok ? 0 : 1;
+}
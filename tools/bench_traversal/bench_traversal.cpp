@@ -8,6 +8,8 @@
 #include "traversal.h"
 #include "load_bvh.h"
 #include "load_rays.h"
+#include "hit_file.h"
+#include "perf_counters.h"
 
 inline void check_argument(int i, int argc, char** argv) {
     if (i + 1 >= argc) {
@@ -21,16 +23,23 @@ inline void usage() {
                  "Available options:\n"
                  "  -bvh     --bvh-file        Sets the BVH file to use\n"
                  "  -ray     --ray-file        Sets the ray file to use\n"
-                 "  -tmin                      Sets the minimum distance along the rays (default: 0)\n"
-                 "  -tmax                      Sets the maximum distance along the rays (default: 1e9)\n"
+                 "  -tmin                      Sets the minimum distance along the rays (default: 0, unless the rays have their own)\n"
+                 "  -tmax                      Sets the maximum distance along the rays (default: 1e9, unless the rays have their own)\n"
                  "  -bench   --bench-iters     Sets the number of benchmark iterations (default: 1)\n"
                  "  -warmup  --bench-warmup    Sets the number of warmup iterations (default: 0)\n"
                  "  -gpu                       Runs the traversal on the GPU (disabled by default)\n"
                  "  -any                       Exits at the first intersection (disabled by default)\n"
+                 "  -depth                     Only loads the captured rays of the given depth (shadow rays with -any, requires masks)\n"
                  "  -s       --single          Uses only single rays on the CPU (incompatible with --packet, disabled by default)\n"
                  "  -p       --packet          Uses only packets of rays on the CPU (incompatible with --single, disabled by default)\n"
                  "  -w       --bvh-width       Sets the BVH width (4 or 8, default: 4)\n"
-                 "  -o       --output          Sets the output file name (no file is generated by default)\n";
+                 "  -stack                     Sets the stack used by the single ray kernel (full, packed or short, default: full)\n"
+                 "  -sl      --stackless       Uses the stackless single ray kernel (requires -any, disabled by default)\n"
+                 "  -wt      --watertight      Uses the watertight ray-triangle test instead of Moeller-Trumbore\n"
+                 "                             (single ray and hybrid kernels with a full stack only, disabled by default)\n"
+                 "  -o       --output          Sets the output file name (no file is generated by default)\n"
+                 "  -hits    --hit-file        Writes the full hits to the given file, for comparison with hitdiff (disabled by default)\n"
+                 "  -perf                      Reads the hardware performance counters during the benchmark (Linux only, disabled by default)\n";
 }
 
 static double bench_cpu_hybrid(Bvh8Tri4* bvh8, Ray8SoA* rays, Hit8SoA* hits, size_t n, bool any_hit) {
@@ -41,6 +50,14 @@ static double bench_cpu_hybrid(Bvh8Tri4* bvh8, Ray8SoA* rays, Hit8SoA* hits, siz
     return (t1 - t0) / 1000.0;
 }
 
+static double bench_cpu_hybrid_watertight(Bvh8Tri4* bvh8, Bvh4TriVertices* verts, Ray8SoA* rays, Hit8SoA* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh8_tri4_hybrid8_watertight_avx2(bvh8, verts, rays, hits, n);
+    else         cpu_intersect_bvh8_tri4_hybrid8_watertight_avx2(bvh8, verts, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
 static double bench_cpu_packet(Bvh8Tri4* bvh8, Ray8SoA* rays, Hit8SoA* hits, size_t n, bool any_hit) {
     auto t0 = anydsl_get_micro_time();
     if (any_hit) cpu_occluded_bvh8_tri4_packet8_avx2(bvh8, rays, hits, n);
@@ -57,6 +74,36 @@ static double bench_cpu_single(Bvh8Tri4* bvh8, Ray1AoS* rays, Hit1AoS* hits, siz
     return (t1 - t0) / 1000.0;
 }
 
+static double bench_cpu_single_watertight(Bvh8Tri4* bvh8, Bvh4TriVertices* verts, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh8_tri4_single_watertight_avx2(bvh8, verts, rays, hits, n);
+    else         cpu_intersect_bvh8_tri4_single_watertight_avx2(bvh8, verts, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
+static double bench_cpu_single_packed(Bvh8Tri4* bvh8, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh8_tri4_single_packed_avx2(bvh8, rays, hits, n);
+    else         cpu_intersect_bvh8_tri4_single_packed_avx2(bvh8, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
+static double bench_cpu_single_short(Bvh8Tri4* bvh8, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh8_tri4_single_short_avx2(bvh8, rays, hits, n);
+    else         cpu_intersect_bvh8_tri4_single_short_avx2(bvh8, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
+// Runs the short stack kernel once more (untimed), counting its restarts and fallbacks to a full stack
+static void count_restarts(Bvh8Tri4* bvh8, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit, int64_t* counts) {
+    if (any_hit) cpu_occluded_bvh8_tri4_single_short_stats_avx2(bvh8, rays, hits, n, counts);
+    else         cpu_intersect_bvh8_tri4_single_short_stats_avx2(bvh8, rays, hits, n, counts);
+}
+
 static double bench_cpu_hybrid(Bvh4* bvh4, Ray8SoA* rays, Hit8SoA* hits, size_t n, bool any_hit) {
     auto t0 = anydsl_get_micro_time();
     if (any_hit) cpu_occluded_bvh4_hybrid8_avx2(bvh4, rays, hits, n);
@@ -65,6 +112,14 @@ static double bench_cpu_hybrid(Bvh4* bvh4, Ray8SoA* rays, Hit8SoA* hits, size_t
     return (t1 - t0) / 1000.0;
 }
 
+static double bench_cpu_hybrid_watertight(Bvh4* bvh4, Bvh4TriVertices* verts, Ray8SoA* rays, Hit8SoA* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh4_hybrid8_watertight_avx2(bvh4, verts, rays, hits, n);
+    else         cpu_intersect_bvh4_hybrid8_watertight_avx2(bvh4, verts, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
 static double bench_cpu_packet(Bvh4* bvh4, Ray8SoA* rays, Hit8SoA* hits, size_t n, bool any_hit) {
     auto t0 = anydsl_get_micro_time();
     if (any_hit) cpu_occluded_bvh4_packet8_avx2(bvh4, rays, hits, n);
@@ -81,6 +136,49 @@ static double bench_cpu_single(Bvh4* bvh4, Ray1AoS* rays, Hit1AoS* hits, size_t
     return (t1 - t0) / 1000.0;
 }
 
+static double bench_cpu_single_watertight(Bvh4* bvh4, Bvh4TriVertices* verts, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh4_single_watertight_avx2(bvh4, verts, rays, hits, n);
+    else         cpu_intersect_bvh4_single_watertight_avx2(bvh4, verts, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
+static double bench_cpu_single_packed(Bvh4* bvh4, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh4_single_packed_avx2(bvh4, rays, hits, n);
+    else         cpu_intersect_bvh4_single_packed_avx2(bvh4, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
+static double bench_cpu_single_short(Bvh4* bvh4, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit) {
+    auto t0 = anydsl_get_micro_time();
+    if (any_hit) cpu_occluded_bvh4_single_short_avx2(bvh4, rays, hits, n);
+    else         cpu_intersect_bvh4_single_short_avx2(bvh4, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
+static void count_restarts(Bvh4* bvh4, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit, int64_t* counts) {
+    if (any_hit) cpu_occluded_bvh4_single_short_stats_avx2(bvh4, rays, hits, n, counts);
+    else         cpu_intersect_bvh4_single_short_stats_avx2(bvh4, rays, hits, n, counts);
+}
+
+static double bench_cpu_stackless(Bvh8Tri4* bvh8, Ray1AoS* rays, Hit1AoS* hits, size_t n) {
+    auto t0 = anydsl_get_micro_time();
+    cpu_occluded_bvh8_tri4_stackless_avx2(bvh8, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
+static double bench_cpu_stackless(Bvh4* bvh4, Ray1AoS* rays, Hit1AoS* hits, size_t n) {
+    auto t0 = anydsl_get_micro_time();
+    cpu_occluded_bvh4_stackless_avx2(bvh4, rays, hits, n);
+    auto t1 = anydsl_get_micro_time();
+    return (t1 - t0) / 1000.0;
+}
+
 static double bench_gpu(Bvh2* bvh2, Ray1AoS* rays, Hit1AoS* hits, size_t n, bool any_hit) {
     auto t0 = anydsl_get_kernel_time();
     if (any_hit) gpu_occluded_nvvm(bvh2, rays, hits, n);
@@ -93,6 +191,7 @@ int main(int argc, char** argv) {
     std::string ray_file;
     std::string bvh_file;
     std::string out_file;
+    std::string hit_file;
     float tmin = 0.0f, tmax = 1e9f;
     int iters = 1;
     int warmup = 0;
@@ -100,6 +199,11 @@ int main(int argc, char** argv) {
     bool any_hit = false;
     int bvh_width = 4;
     bool single = false, packet = false;
+    std::string stack = "full";
+    bool stackless = false;
+    bool watertight = false;
+    bool perf = false;
+    int depth = -1;
 
     for (int i = 1; i < argc; i++) {
         auto arg = argv[i];
@@ -129,6 +233,9 @@ int main(int argc, char** argv) {
                 use_gpu = true;
             } else if (!strcmp(arg, "-any")) {
                 any_hit = true;
+            } else if (!strcmp(arg, "-depth")) {
+                check_argument(i, argc, argv);
+                depth = strtol(argv[++i], nullptr, 10);
             } else if (!strcmp(arg, "-s") || !strcmp(arg, "--single")) {
                 single = true;
             } else if (!strcmp(arg, "-p") || !strcmp(arg, "--packet")) {
@@ -136,9 +243,21 @@ int main(int argc, char** argv) {
             } else if (!strcmp(arg, "-w") || !strcmp(arg, "--bvh-width")) {
                 check_argument(i, argc, argv);
                 bvh_width = strtol(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-stack")) {
+                check_argument(i, argc, argv);
+                stack = argv[++i];
+            } else if (!strcmp(arg, "-sl") || !strcmp(arg, "--stackless")) {
+                stackless = true;
+            } else if (!strcmp(arg, "-wt") || !strcmp(arg, "--watertight")) {
+                watertight = true;
             } else if (!strcmp(arg, "-o") || !strcmp(arg, "--output")) {
                 check_argument(i, argc, argv);
                 out_file = argv[++i];
+            } else if (!strcmp(arg, "-hits") || !strcmp(arg, "--hit-file")) {
+                check_argument(i, argc, argv);
+                hit_file = argv[++i];
+            } else if (!strcmp(arg, "-perf")) {
+                perf = true;
             } else {
                 std::cerr << "Unknown option '" << arg << "'" << std::endl;
                 return 1;
@@ -170,12 +289,39 @@ int main(int argc, char** argv) {
         std::cerr << "Invalid BVH width" << std::endl;
         return 1;
     }
+    if (stack != "full" && stack != "packed" && stack != "short") {
+        std::cerr << "Invalid stack type" << std::endl;
+        return 1;
+    }
+    if (stack != "full" && !single) {
+        std::cerr << "Option '-stack' requires '--single'" << std::endl;
+        return 1;
+    }
+    if (stackless && (!any_hit || use_gpu || packet || stack != "full")) {
+        std::cerr << "Option '--stackless' requires '-any', and is incompatible with '--gpu', '--packet' and '-stack'" << std::endl;
+        return 1;
+    }
+    if (watertight && (use_gpu || packet || stack != "full" || stackless)) {
+        std::cerr << "Option '--watertight' is incompatible with '--gpu', '--packet', '-stack' and '--stackless'" << std::endl;
+        return 1;
+    }
+    if (perf && use_gpu) {
+        std::cerr << "Option '-perf' is incompatible with '--gpu'" << std::endl;
+        return 1;
+    }
+    if (depth > 0xFFFF) {
+        std::cerr << "Invalid ray depth" << std::endl;
+        return 1;
+    }
+    // The stackless kernel uses single rays
+    if (stackless) single = true;
 
     anydsl::Array<Bvh2Node> nodes2;
     anydsl::Array<Bvh4Node> nodes4;
     anydsl::Array<Bvh8Node> nodes8;
     anydsl::Array<Bvh2Tri>  tris2;
     anydsl::Array<Bvh4Tri>  tris4;
+    anydsl::Array<Bvh4TriVertices> verts4;
 
     Bvh8Tri4 bvh8tri4;
     Bvh4 bvh4;
@@ -192,27 +338,47 @@ int main(int argc, char** argv) {
                 std::cerr << "Cannot load BVH file" << std::endl;
                 return 1;
             }
+            if (stackless) link_bvh_nodes(nodes4.data(), nodes4.size());
             bvh4 = Bvh4{ nodes4.data(), tris4.data() };
         } else {
             if (!load_bvh(bvh_file, nodes8, tris4, BvhType::BVH8_TRI4, false)) {
                 std::cerr << "Cannot load BVH file" << std::endl;
                 return 1;
             }
+            if (stackless) link_bvh_nodes(nodes8.data(), nodes8.size());
             bvh8tri4 = Bvh8Tri4{ nodes8.data(), tris4.data() };
         }
+        // The watertight test needs the exact vertices, which are stored in a separate block
+        auto vertex_block = bvh_width == 4 ? BvhType::BVH4_VERTICES : BvhType::BVH8_TRI4_VERTICES;
+        if (watertight && (!load_bvh_vertices(bvh_file, verts4, vertex_block) || verts4.size() != tris4.size())) {
+            std::cerr << "The BVH file has no triangle vertices (required by '--watertight'), extract the BVH again" << std::endl;
+            return 1;
+        }
+    }
+
+    // Packed stack entries keep 10 bits of tmin, leaving 22 bits for node indices (except for any-hit packed stacks)
+    if (stack == "packed" && !any_hit) {
+        const size_t max_index = size_t(1) << 21;
+        if (nodes4.size() >= max_index || nodes8.size() >= max_index || tris4.size() >= max_index) {
+            std::cerr << "BVH too large for the '" << stack << "' stack" << std::endl;
+            return 1;
+        }
     }
 
     anydsl::Array<Ray1AoS> rays1;
     anydsl::Array<Ray8SoA> rays8;
     size_t ray_count = 0;
+    RayFileInfo ray_info;
+    uint32_t ray_mask = ray_capture_mask(depth, any_hit);
+    auto ray_filter = depth >= 0 ? &ray_mask : nullptr;
     if (use_gpu || single) {
-        if (!load_rays(ray_file, rays1, tmin, tmax, use_gpu)) {
+        if (!load_rays(ray_file, rays1, tmin, tmax, use_gpu, &ray_info, ray_filter)) {
             std::cerr << "Cannot load rays" << std::endl;
             return 1;
         }
         ray_count = rays1.size();
     } else {
-        if (!load_rays(ray_file, rays8, tmin, tmax, false)) {
+        if (!load_rays(ray_file, rays8, tmin, tmax, false, &ray_info, ray_filter)) {
             std::cerr << "Cannot load rays" << std::endl;
             return 1;
         }
@@ -220,6 +386,8 @@ int main(int argc, char** argv) {
     }
     
     std::cout << ray_count << " ray(s) in the distribution file." << std::endl;
+    if (ray_info.has_extents)
+        std::cout << "The rays have their own extents (-tmin and -tmax are ignored)." << std::endl;
 
     anydsl::Array<Hit1AoS> hits1;
     anydsl::Array<Hit8SoA> hits8;
@@ -233,24 +401,49 @@ int main(int argc, char** argv) {
     if (use_gpu) bench = [&] { return bench_gpu(&bvh2, rays1.data(), hits1.data(), ray_count, any_hit); };
     else {
         if (bvh_width == 4) {
-            if (single)      bench = [&] { return bench_cpu_single(&bvh4, rays1.data(), hits1.data(), ray_count, any_hit); };
-            else if (packet) bench = [&] { return bench_cpu_packet(&bvh4, rays8.data(), hits8.data(), ray_count, any_hit); };
-            else             bench = [&] { return bench_cpu_hybrid(&bvh4, rays8.data(), hits8.data(), ray_count, any_hit); };
+            if (stackless)                        bench = [&] { return bench_cpu_stackless(&bvh4, rays1.data(), hits1.data(), ray_count); };
+            else if (single && stack == "packed") bench = [&] { return bench_cpu_single_packed(&bvh4, rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (single && stack == "short")  bench = [&] { return bench_cpu_single_short(&bvh4, rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (single && watertight)        bench = [&] { return bench_cpu_single_watertight(&bvh4, verts4.data(), rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (single)                      bench = [&] { return bench_cpu_single(&bvh4, rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (packet)                      bench = [&] { return bench_cpu_packet(&bvh4, rays8.data(), hits8.data(), ray_count, any_hit); };
+            else if (watertight)                  bench = [&] { return bench_cpu_hybrid_watertight(&bvh4, verts4.data(), rays8.data(), hits8.data(), ray_count, any_hit); };
+            else                                  bench = [&] { return bench_cpu_hybrid(&bvh4, rays8.data(), hits8.data(), ray_count, any_hit); };
         } else {
-            if (single)      bench = [&] { return bench_cpu_single(&bvh8tri4, rays1.data(), hits1.data(), ray_count, any_hit); };
-            else if (packet) bench = [&] { return bench_cpu_packet(&bvh8tri4, rays8.data(), hits8.data(), ray_count, any_hit); };
-            else             bench = [&] { return bench_cpu_hybrid(&bvh8tri4, rays8.data(), hits8.data(), ray_count, any_hit); };
+            if (stackless)                        bench = [&] { return bench_cpu_stackless(&bvh8tri4, rays1.data(), hits1.data(), ray_count); };
+            else if (single && stack == "packed") bench = [&] { return bench_cpu_single_packed(&bvh8tri4, rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (single && stack == "short")  bench = [&] { return bench_cpu_single_short(&bvh8tri4, rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (single && watertight)        bench = [&] { return bench_cpu_single_watertight(&bvh8tri4, verts4.data(), rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (single)                      bench = [&] { return bench_cpu_single(&bvh8tri4, rays1.data(), hits1.data(), ray_count, any_hit); };
+            else if (packet)                      bench = [&] { return bench_cpu_packet(&bvh8tri4, rays8.data(), hits8.data(), ray_count, any_hit); };
+            else if (watertight)                  bench = [&] { return bench_cpu_hybrid_watertight(&bvh8tri4, verts4.data(), rays8.data(), hits8.data(), ray_count, any_hit); };
+            else                                  bench = [&] { return bench_cpu_hybrid(&bvh8tri4, rays8.data(), hits8.data(), ray_count, any_hit); };
         }
     }
 
     for (int i = 0; i < warmup; i++) bench();
 
+    // Counters are only enabled around the timed iterations
+    PerfCounters counters;
+    if (perf && !counters.available())
+        std::cerr << "Cannot open the performance counters (see /proc/sys/kernel/perf_event_paranoid)" << std::endl;
+
     std::vector<double> timings;
     for (int i = 0; i < iters; i++) {
+        if (perf) counters.start();
         timings.push_back(bench());
+        if (perf) counters.stop();
+    }
+
+    // Restarts of the short stack, counted outside of the timed iterations
+    int64_t restarts[2] = { 0, 0 };
+    if (!use_gpu && single && stack == "short") {
+        if (bvh_width == 4) count_restarts(&bvh4, rays1.data(), hits1.data(), ray_count, any_hit, restarts);
+        else                count_restarts(&bvh8tri4, rays1.data(), hits1.data(), ray_count, any_hit, restarts);
     }
 
     size_t intr = 0;
+    std::vector<HitRecord> hit_records;
     if (use_gpu || single) {
         anydsl::Array<Hit1AoS> host_hits(hits1.size());
         anydsl::copy(hits1, host_hits);
@@ -261,6 +454,10 @@ int main(int argc, char** argv) {
             for (auto& hit : host_hits)
                 of.write((char*)&hit.t, sizeof(float));
         }
+        if (hit_file != "") {
+            for (auto& hit : host_hits)
+                hit_records.push_back(HitRecord { hit.tri_id, hit.t, hit.u, hit.v });
+        }
     } else {
         for (auto& hit : hits8) {
             for (int i = 0; i < 8; i++)
@@ -273,8 +470,27 @@ int main(int argc, char** argv) {
                     of.write((char*)&hit.t[i], sizeof(float));
             }
         }
+        if (hit_file != "") {
+            for (auto& hit : hits8) {
+                for (int i = 0; i < 8; i++)
+                    hit_records.push_back(HitRecord { hit.tri_id[i], hit.t[i], hit.u[i], hit.v[i] });
+            }
+        }
+    }
+    // The padding of the last packet is not part of the results
+    if (hit_file != "") {
+        hit_records.resize(std::min(hit_records.size(), ray_info.ray_count));
+        if (!write_hits(hit_file, hit_records, any_hit)) {
+            std::cerr << "Cannot write hit file" << std::endl;
+            return 1;
+        }
     }
 
+    // Timings of every iteration, in order, for statistical analysis
+    std::cout << "# Timings (ms):";
+    for (auto t : timings) std::cout << " " << t;
+    std::cout << std::endl;
+
     std::sort(timings.begin(), timings.end());
     auto sum = std::accumulate(timings.begin(), timings.end(), 0.0);
     auto avg = sum / timings.size();
@@ -286,5 +502,26 @@ int main(int argc, char** argv) {
     std::cout << "# Median: " << med  << " ms" << std::endl;
     std::cout << "# Min: " << min << " ms" << std::endl;
     std::cout << intr << " intersection(s)" << std::endl;
+    std::cout << ray_count - intr << " miss(es) (" << 100.0 * (ray_count - intr) / ray_count << "%)" << std::endl;
+    if (!use_gpu && single && stack == "short") {
+        std::cout << "# Restarts: " << restarts[0] << " (" << double(restarts[0]) / ray_count << " per ray)" << std::endl;
+        std::cout << "# Fallbacks to a full stack: " << restarts[1] << " (" << 100.0 * restarts[1] / ray_count << "% of the rays)" << std::endl;
+    }
+
+    if (perf && counters.available()) {
+        auto& values = counters.counters();
+        auto total_rays = double(ray_count) * iters;
+        for (auto& counter : values) {
+            if (!counter.valid)
+                std::cout << "# Perf: " << counter.name << " not available" << std::endl;
+            else if (!counter.counted)
+                std::cout << "# Perf: " << counter.name << " not counted (the counters were never scheduled)" << std::endl;
+            else
+                std::cout << "# Perf: " << counter.value / total_rays << " " << counter.name << " per ray" << std::endl;
+        }
+        // Instructions per cycle, when both counters are available
+        if (values[0].counted && values[1].counted && values[0].value > 0)
+            std::cout << "# Perf: " << double(values[1].value) / values[0].value << " instructions per cycle" << std::endl;
+    }
     return 0;
 }
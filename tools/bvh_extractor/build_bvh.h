@@ -0,0 +1,15 @@
+#ifndef BUILD_BVH_H
+#define BUILD_BVH_H
+
+#include <fstream>
+#include <vector>
+
+#include "tri.h"
+
+/// Builds a BVH and writes it as a block of a BVH file.
+/// Returns the number of nodes, or 0 if the BVH could not be built.
+int build_bvh8(std::ofstream&, const std::vector<Tri>&);
+int build_bvh4(std::ofstream&, const std::vector<Tri>&);
+int build_bvh2(std::ofstream&, const std::vector<Tri>&);
+
+#endif // BUILD_BVH_H
@@ -6,10 +6,7 @@
 #include "load_obj.h"
 #include "file_path.h"
 #include "tri.h"
-
-int build_bvh8(std::ofstream&, const std::vector<Tri>&);
-int build_bvh4(std::ofstream&, const std::vector<Tri>&);
-int build_bvh2(std::ofstream&, const std::vector<Tri>&);
+#include "build_bvh.h"
 
 inline void check_argument(int i, int argc, char** argv) {
     if (i + 1 >= argc) {
@@ -112,7 +109,7 @@ int main(int argc, char** argv) {
     std::cout << "BVH4 successfully built (" << bvh4_nodes << " nodes)" << std::endl;
 
     int bvh2_nodes = build_bvh2(out, tris);
-    if (!bvh4_nodes) {
+    if (!bvh2_nodes) {
         std::cerr << "Cannot build a BVH2" << std::endl;
         return 1;
     }
@@ -2,6 +2,7 @@
 
 #include "traversal.h"
 #include "sbvh_builder.h"
+#include "build_bvh.h"
 
 static void fill_dummy_parent(Bvh2Node& node, const BBox& leaf_bb, int index) {
     node.left  = index;
@@ -10,6 +10,7 @@
 #include "traversal.h"
 #include "load_bvh.h"
 #include "tri.h"
+#include "build_bvh.h"
 
 using namespace embree;
 
@@ -34,12 +35,17 @@ static void error_handler(const RTCError code, const char* str) {
     abort();
 }
 
-template <int M, typename NodeRef, typename BvhTri>
-void extract_bvh_leaf(NodeRef leaf, std::vector<BvhTri>& new_tris) {
+// The vertex packets hold the input vertices of the same triangles, in the same order,
+// since v0 - e1 and v0 + e2 are not exactly the vertices that were given to Embree.
+template <int M, typename NodeRef, typename BvhTri, typename BvhTriVertices>
+void extract_bvh_leaf(NodeRef leaf, const std::vector<Tri>& in_tris,
+                      std::vector<BvhTri>& new_tris,
+                      std::vector<BvhTriVertices>& new_verts) {
     size_t num; 
     auto tris = (const Triangle4*)leaf.leaf(num);
 
     BvhTri new_tri;
+    BvhTriVertices new_vert;
     size_t cur = 0;
     for (size_t i = 0; i < num; i++) {
         for (size_t j = 0; j < tris[i].size(); j++) {
@@ -56,10 +62,23 @@ void extract_bvh_leaf(NodeRef leaf, std::vector<BvhTri>& new_tris) {
             new_tri. n[1][cur] = new_tri.e1[2][cur] * new_tri.e2[0][cur] - new_tri.e1[0][cur] * new_tri.e2[2][cur];
             new_tri. n[2][cur] = new_tri.e1[0][cur] * new_tri.e2[1][cur] - new_tri.e1[1][cur] * new_tri.e2[0][cur];
             new_tri.id[cur] = tris[i].primID(j);
+
+            auto& in_tri = in_tris[tris[i].primID(j)];
+            new_vert.v0[0][cur] = in_tri.v0.x;
+            new_vert.v0[1][cur] = in_tri.v0.y;
+            new_vert.v0[2][cur] = in_tri.v0.z;
+            new_vert.v1[0][cur] = in_tri.v1.x;
+            new_vert.v1[1][cur] = in_tri.v1.y;
+            new_vert.v1[2][cur] = in_tri.v1.z;
+            new_vert.v2[0][cur] = in_tri.v2.x;
+            new_vert.v2[1][cur] = in_tri.v2.y;
+            new_vert.v2[2][cur] = in_tri.v2.z;
+            new_vert.id[cur] = new_tri.id[cur];
             cur++;
 
             if (cur >= M) {
                 new_tris.push_back(new_tri);
+                new_verts.push_back(new_vert);
                 cur = 0;
             }
         }
@@ -79,16 +98,26 @@ void extract_bvh_leaf(NodeRef leaf, std::vector<BvhTri>& new_tris) {
             new_tri.n[1][j]  = 0.0f;
             new_tri.n[2][j]  = 0.0f;
             new_tri.id[j]    = 0xFFFFFFFF;
+            for (int k = 0; k < 3; k++) {
+                new_vert.v0[k][j] = 0.0f;
+                new_vert.v1[k][j] = 0.0f;
+                new_vert.v2[k][j] = 0.0f;
+            }
+            new_vert.id[j] = 0xFFFFFFFF;
         }
         new_tris.push_back(new_tri);
+        new_verts.push_back(new_vert);
     }
     new_tris.back().id[M - 1] |= 0x80000000;
+    new_verts.back().id[M - 1] |= 0x80000000;
 }
 
-template <int N, int M, typename Bvh, typename NodeRef, typename BvhNode, typename BvhTri>
+template <int N, int M, typename Bvh, typename NodeRef, typename BvhNode, typename BvhTri, typename BvhTriVertices>
 void extract_bvh_node(NodeRef node, int index,
+                      const std::vector<Tri>& in_tris,
                       std::vector<BvhNode>& new_nodes,
-                      std::vector<BvhTri>&  new_tris) {
+                      std::vector<BvhTri>&  new_tris,
+                      std::vector<BvhTriVertices>& new_verts) {
     assert(node.isAlignedNode());
 
     auto n = node.alignedNode();
@@ -114,10 +143,10 @@ void extract_bvh_node(NodeRef node, int index,
 
         if (n->child(i).isAlignedNode()) {
             new_node.child[c] = first_child + 1;
-            extract_bvh_node<N, M, Bvh>(n->child(i), first_child++, new_nodes, new_tris);
+            extract_bvh_node<N, M, Bvh>(n->child(i), first_child++, in_tris, new_nodes, new_tris, new_verts);
         } else if (n->child(i).isLeaf()) {
             new_node.child[c] = ~new_tris.size();
-            extract_bvh_leaf<M>(n->child(i), new_tris);
+            extract_bvh_leaf<M>(n->child(i), in_tris, new_tris, new_verts);
         } else {
             assert(false);
             continue;
@@ -134,7 +163,7 @@ void extract_bvh_node(NodeRef node, int index,
     new_nodes[index] = new_node;
 }
 
-template <int N, typename Bvh, typename BvhNode, typename BvhTri>
+template <int N, typename Bvh, typename BvhNode, typename BvhTri, typename BvhTriVertices>
 int build_embree_bvh(std::ofstream& out, const std::vector<Tri>& tris) {
     static_assert(N == 4 || N == 8, "N must be 4 or 8");
 
@@ -175,8 +204,10 @@ int build_embree_bvh(std::ofstream& out, const std::vector<Tri>& tris) {
 
     std::vector<BvhNode> new_nodes;
     std::vector<BvhTri>  new_tris;
+    std::vector<BvhTriVertices> new_verts;
     new_nodes.emplace_back();
-    extract_bvh_node<N, 4, Bvh>(bvh->root, 0, new_nodes, new_tris);
+    extract_bvh_node<N, 4, Bvh>(bvh->root, 0, tris, new_nodes, new_tris, new_verts);
+    link_bvh_nodes(new_nodes.data(), new_nodes.size());
 
     uint64_t offset = sizeof(uint32_t) * 3 +
         sizeof(BvhNode) * new_nodes.size() +
@@ -192,16 +223,28 @@ int build_embree_bvh(std::ofstream& out, const std::vector<Tri>& tris) {
     out.write((char*)new_nodes.data(), sizeof(BvhNode) * new_nodes.size());
     out.write((char*)new_tris.data(),  sizeof(BvhTri)  * new_tris.size());
 
+    // Optional block with the vertices of the triangles, for the watertight intersection test
+    offset = sizeof(uint32_t) * 3 + sizeof(BvhTriVertices) * new_verts.size();
+    block_type = uint32_t(N == 4 ? BvhType::BVH4_VERTICES : BvhType::BVH8_TRI4_VERTICES);
+    uint32_t no_nodes = 0;
+    uint32_t num_verts = new_verts.size();
+
+    out.write((char*)&offset,     sizeof(uint64_t));
+    out.write((char*)&block_type, sizeof(uint32_t));
+    out.write((char*)&no_nodes,   sizeof(uint32_t));
+    out.write((char*)&num_verts,  sizeof(uint32_t));
+    out.write((char*)new_verts.data(), sizeof(BvhTriVertices) * new_verts.size());
+
     rtcDeleteScene(scene);
     rtcDeleteDevice(device);
 
     return new_nodes.size();
 }
 
-void build_bvh4(std::ofstream& out, const std::vector<Tri>& tris) {
-    build_embree_bvh<4, BVH4, Bvh4Node, Bvh4Tri>(out, tris);
+int build_bvh4(std::ofstream& out, const std::vector<Tri>& tris) {
+    return build_embree_bvh<4, BVH4, Bvh4Node, Bvh4Tri, Bvh4TriVertices>(out, tris);
 }
 
-void build_bvh8(std::ofstream& out, const std::vector<Tri>& tris) {
-    build_embree_bvh<8, BVH8, Bvh8Node, Bvh4Tri>(out, tris);
+int build_bvh8(std::ofstream& out, const std::vector<Tri>& tris) {
+    return build_embree_bvh<8, BVH8, Bvh8Node, Bvh4Tri, Bvh4TriVertices>(out, tris);
 }
@@ -0,0 +1,498 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <functional>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+#include "traversal.h"
+#include "load_bvh.h"
+#include "float3.h"
+#include "bbox.h"
+
+/// Costs of the surface area heuristic, with the same interface as the CostFn of the builders.
+struct CostFn {
+    float node_cost;    ///< Cost of traversing an inner node
+    float tri_cost;     ///< Cost of intersecting a triangle (or a packet of triangles)
+    bool per_packet;    ///< True if leaves are charged per packet of triangles, instead of per triangle
+
+    float leaf_cost(int count, float area) const { return count * area * tri_cost; }
+    float traversal_cost(float area) const { return area * node_cost; }
+};
+
+struct TriRef {
+    float3 v0, v1, v2;
+    uint32_t id;
+};
+
+/// BVH of any width, converted from the blocks of BVH files.
+/// Leaves are nodes without children, and every node stores the bounding box given by its parent.
+struct StatsBvh {
+    struct Node {
+        BBox bbox;
+        std::vector<int> children;
+        int empty_slots;    // Unused child slots (child == 0) of inner nodes
+        int depth;
+        int tri_begin, tri_end;
+        int packets;        // Packets of triangles in leaves
+        int padding;        // Unused triangle slots (id == 0xFFFFFFFF) in leaves
+
+        bool is_leaf() const { return children.empty(); }
+    };
+
+    std::vector<Node> nodes;
+    std::vector<TriRef> tris;
+    int width;
+    int tri_width;
+
+    StatsBvh(int width, int tri_width) : width(width), tri_width(tri_width) {}
+
+    int add_node(const BBox& bbox, int depth) {
+        Node node;
+        node.bbox = bbox;
+        node.empty_slots = 0;
+        node.depth = depth;
+        node.tri_begin = node.tri_end = tris.size();
+        node.packets = node.padding = 0;
+        nodes.push_back(node);
+        return nodes.size() - 1;
+    }
+};
+
+static BBox node_bbox(const Bvh4Node& node, int i) {
+    return BBox(float3(node.bounds[0][i], node.bounds[2][i], node.bounds[4][i]),
+                float3(node.bounds[1][i], node.bounds[3][i], node.bounds[5][i]));
+}
+
+static BBox node_bbox(const Bvh8Node& node, int i) {
+    return BBox(float3(node.bounds[0][i], node.bounds[2][i], node.bounds[4][i]),
+                float3(node.bounds[1][i], node.bounds[3][i], node.bounds[5][i]));
+}
+
+static BBox node_bbox(const Bvh2Node& node, int i) {
+    auto& bb = i == 0 ? node.left_bb : node.right_bb;
+    return BBox(float3(bb.lo_x, bb.lo_y, bb.lo_z), float3(bb.hi_x, bb.hi_y, bb.hi_z));
+}
+
+static int node_child(const Bvh4Node& node, int i) { return node.child[i]; }
+static int node_child(const Bvh8Node& node, int i) { return node.child[i]; }
+static int node_child(const Bvh2Node& node, int i) { return i == 0 ? node.left : node.right; }
+
+// Leaves are terminated by the sentinel bit in the last id, and padded with 0xFFFFFFFF
+static void read_leaf(const anydsl::Array<Bvh4Tri>& tris, int first, StatsBvh& bvh, StatsBvh::Node& leaf) {
+    for (int i = first; i < (int)tris.size(); i++) {
+        auto& tri = tris[i];
+        for (int j = 0; j < 4; j++) {
+            if (uint32_t(tri.id[j]) == 0xFFFFFFFF) {
+                leaf.padding++;
+                continue;
+            }
+            float3 v0(tri.v0[0][j], tri.v0[1][j], tri.v0[2][j]);
+            float3 e1(tri.e1[0][j], tri.e1[1][j], tri.e1[2][j]);
+            float3 e2(tri.e2[0][j], tri.e2[1][j], tri.e2[2][j]);
+            bvh.tris.push_back(TriRef { v0, v0 - e1, v0 + e2, uint32_t(tri.id[j]) & 0x7FFFFFFF });
+        }
+        leaf.packets++;
+        if (tri.id[3] & 0x80000000) break;
+    }
+}
+
+static void read_leaf(const anydsl::Array<Bvh2Tri>& tris, int first, StatsBvh& bvh, StatsBvh::Node& leaf) {
+    for (int i = first; i < (int)tris.size(); i++) {
+        auto& tri = tris[i];
+        float3 v0(tri.v0[0], tri.v0[1], tri.v0[2]);
+        float3 e1(tri.e1[0], tri.e1[1], tri.e1[2]);
+        float3 e2(tri.e2[0], tri.e2[1], tri.e2[2]);
+        bvh.tris.push_back(TriRef { v0, v0 - e1, v0 + e2, uint32_t(tri.id) & 0x7FFFFFFF });
+        leaf.packets++;
+        if (tri.id & 0x80000000) break;
+    }
+}
+
+template <int N, typename Node, typename Tri>
+static void convert_bvh(const anydsl::Array<Node>& nodes, const anydsl::Array<Tri>& tris, StatsBvh& bvh) {
+    // The bounding box of the root is the union of the boxes of its children
+    auto root_bbox = BBox::empty();
+    for (int i = 0; i < N; i++) {
+        if (node_child(nodes[0], i) != 0) root_bbox.extend(node_bbox(nodes[0], i));
+    }
+
+    struct StackElem { int src, dst; };
+    std::vector<StackElem> stack;
+    stack.push_back(StackElem { 0, bvh.add_node(root_bbox, 0) });
+    while (!stack.empty()) {
+        auto elem = stack.back();
+        stack.pop_back();
+
+        auto& node = nodes[elem.src];
+        auto depth = bvh.nodes[elem.dst].depth + 1;
+        for (int i = 0; i < N; i++) {
+            auto child = node_child(node, i);
+            if (child == 0) {
+                bvh.nodes[elem.dst].empty_slots++;
+                continue;
+            }
+            auto index = bvh.add_node(node_bbox(node, i), depth);
+            bvh.nodes[elem.dst].children.push_back(index);
+            if (child > 0) {
+                stack.push_back(StackElem { child - 1, index });
+            } else {
+                auto& leaf = bvh.nodes[index];
+                read_leaf(tris, ~child, bvh, leaf);
+                leaf.tri_end = bvh.tris.size();
+            }
+        }
+    }
+}
+
+static bool load_stats_bvh(const std::string& file, BvhType type, StatsBvh& bvh) {
+    anydsl::Array<Bvh4Tri> tris4;
+    switch (type) {
+        case BvhType::BVH2: {
+            anydsl::Array<Bvh2Node> nodes;
+            anydsl::Array<Bvh2Tri> tris;
+            if (!load_bvh(file, nodes, tris, type, false) || nodes.size() == 0) return false;
+            bvh = StatsBvh(2, 1);
+            convert_bvh<2>(nodes, tris, bvh);
+            return true;
+        }
+        case BvhType::BVH4: {
+            anydsl::Array<Bvh4Node> nodes;
+            if (!load_bvh(file, nodes, tris4, type, false) || nodes.size() == 0) return false;
+            bvh = StatsBvh(4, 4);
+            convert_bvh<4>(nodes, tris4, bvh);
+            return true;
+        }
+        case BvhType::BVH8_TRI4: {
+            anydsl::Array<Bvh8Node> nodes;
+            if (!load_bvh(file, nodes, tris4, type, false) || nodes.size() == 0) return false;
+            bvh = StatsBvh(8, 4);
+            convert_bvh<8>(nodes, tris4, bvh);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Area of the part of the triangle that is inside the box (Sutherland-Hodgman clipping)
+static float clipped_area(const TriRef& tri, const BBox& bbox) {
+    float3 poly[9], next[9];
+    int count = 3;
+    poly[0] = tri.v0;
+    poly[1] = tri.v1;
+    poly[2] = tri.v2;
+    for (int axis = 0; axis < 3 && count > 0; axis++) {
+        for (int side = 0; side < 2 && count > 0; side++) {
+            auto plane = side == 0 ? bbox.min[axis] : bbox.max[axis];
+            auto inside = [&] (const float3& p) { return side == 0 ? p[axis] >= plane : p[axis] <= plane; };
+            int next_count = 0;
+            for (int i = 0; i < count; i++) {
+                auto& a = poly[i];
+                auto& b = poly[(i + 1) % count];
+                if (inside(a)) next[next_count++] = a;
+                if (inside(a) != inside(b)) {
+                    auto t = (plane - a[axis]) / (b[axis] - a[axis]);
+                    next[next_count++] = a + t * (b - a);
+                }
+            }
+            std::copy(next, next + next_count, poly);
+            count = next_count;
+        }
+    }
+
+    float3 sum(0.0f);
+    for (int i = 1; i + 1 < count; i++)
+        sum = sum + cross(poly[i] - poly[0], poly[i + 1] - poly[0]);
+    return length(sum) * 0.5f;
+}
+
+// Effective parallel overlap (Aila et al. 2013): surface area of the geometry that lies inside
+// the box of a node without being part of its subtree, weighted by the cost of the node
+static double compute_epo(const StatsBvh& bvh, const CostFn& cost) {
+    std::vector<double> node_epo(bvh.nodes.size(), 0.0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, bvh.nodes.size()), [&] (const tbb::blocked_range<size_t>& range) {
+        std::vector<int> stack;
+        for (auto n = range.begin(); n != range.end(); n++) {
+            auto& node = bvh.nodes[n];
+            if (node.bbox.is_empty()) continue;
+
+            double area = 0.0;
+            stack.assign(1, 0);
+            while (!stack.empty()) {
+                auto m = stack.back();
+                stack.pop_back();
+                auto& other = bvh.nodes[m];
+                if (m == int(n) || !other.bbox.is_overlapping(node.bbox)) continue;
+                if (other.is_leaf()) {
+                    // References of split triangles only cover the part of the triangle inside their leaf
+                    auto clip = node.bbox;
+                    clip.overlap(other.bbox);
+                    for (int i = other.tri_begin; i < other.tri_end; i++)
+                        area += clipped_area(bvh.tris[i], clip);
+                } else {
+                    stack.insert(stack.end(), other.children.begin(), other.children.end());
+                }
+            }
+
+            auto count = cost.per_packet ? node.packets : node.tri_end - node.tri_begin;
+            node_epo[n] = area * (node.is_leaf() ? cost.leaf_cost(count, 1.0f) : cost.traversal_cost(1.0f));
+        }
+    });
+
+    // Every triangle counts once in the total area, even if it is referenced by several leaves
+    std::vector<bool> seen;
+    double total_area = 0.0;
+    for (auto& tri : bvh.tris) {
+        if (tri.id >= seen.size()) seen.resize(tri.id + 1, false);
+        if (seen[tri.id]) continue;
+        seen[tri.id] = true;
+        total_area += length(cross(tri.v1 - tri.v0, tri.v2 - tri.v0)) * 0.5f;
+    }
+
+    double epo = 0.0;
+    for (auto e : node_epo) epo += e;
+    return total_area > 0.0 ? epo / total_area : 0.0;
+}
+
+// Siblings that only touch do not overlap, unless they are flat along the same axis (e.g. planar scenes)
+static bool is_overlapping(const BBox& a, const BBox& b) {
+    for (int axis = 0; axis < 3; axis++) {
+        auto lo = std::max(a.min[axis], b.min[axis]);
+        auto hi = std::min(a.max[axis], b.max[axis]);
+        auto flat = a.min[axis] == a.max[axis] && b.min[axis] == b.max[axis];
+        if (hi < lo || (hi == lo && !flat)) return false;
+    }
+    return true;
+}
+
+struct BvhStats {
+    std::string name;
+    size_t inner_count = 0, leaf_count = 0;
+    size_t tri_refs = 0, unique_tris = 0;
+    size_t empty_slots = 0, tri_slots = 0, padding = 0;
+    double sah = 0.0, inner_sah = 0.0, leaf_sah = 0.0;
+    double overlap = 0.0, relative_overlap = 0.0;
+    double avg_depth = 0.0;
+    int max_depth = 0;
+    double epo = -1.0;
+    std::vector<size_t> depth_histogram;    // Leaves per depth
+    std::vector<size_t> leaf_histogram;     // Leaves per number of triangles
+    std::vector<size_t> child_histogram;    // Inner nodes per number of children
+};
+
+static BvhStats compute_stats(const std::string& name, const StatsBvh& bvh, const CostFn& cost, bool epo) {
+    BvhStats stats;
+    stats.name = name;
+    stats.child_histogram.resize(bvh.width + 1, 0);
+
+    auto root_area = bvh.nodes[0].bbox.half_area();
+    auto inv_root_area = root_area > 0.0f ? 1.0 / root_area : 0.0;
+    std::vector<bool> seen;
+    for (auto& node : bvh.nodes) {
+        auto area = node.bbox.is_empty() ? 0.0f : node.bbox.half_area();
+        if (node.is_leaf()) {
+            auto count = node.tri_end - node.tri_begin;
+            stats.leaf_count++;
+            stats.tri_refs += count;
+            stats.tri_slots += node.packets * bvh.tri_width;
+            stats.padding += node.padding;
+            stats.leaf_sah += cost.leaf_cost(cost.per_packet ? node.packets : count, area) * inv_root_area;
+            stats.avg_depth += node.depth;
+            stats.max_depth = std::max(stats.max_depth, node.depth);
+            if (node.depth >= (int)stats.depth_histogram.size()) stats.depth_histogram.resize(node.depth + 1, 0);
+            stats.depth_histogram[node.depth]++;
+            if (count >= (int)stats.leaf_histogram.size()) stats.leaf_histogram.resize(count + 1, 0);
+            stats.leaf_histogram[count]++;
+            for (int i = node.tri_begin; i < node.tri_end; i++) {
+                auto id = bvh.tris[i].id;
+                if (id >= seen.size()) seen.resize(id + 1, false);
+                stats.unique_tris += !seen[id];
+                seen[id] = true;
+            }
+        } else {
+            stats.inner_count++;
+            stats.empty_slots += node.empty_slots;
+            stats.inner_sah += cost.traversal_cost(area) * inv_root_area;
+            stats.child_histogram[node.children.size()]++;
+
+            // Overlap of every pair of children, relative to the root and to the node
+            double overlap = 0.0;
+            for (size_t i = 0; i < node.children.size(); i++) {
+                for (size_t j = i + 1; j < node.children.size(); j++) {
+                    auto& a = bvh.nodes[node.children[i]].bbox;
+                    auto& b = bvh.nodes[node.children[j]].bbox;
+                    if (is_overlapping(a, b)) overlap += BBox(a).overlap(b).half_area();
+                }
+            }
+            stats.overlap += overlap * inv_root_area;
+            if (area > 0.0f) stats.relative_overlap += overlap / area;
+        }
+    }
+    stats.sah = stats.inner_sah + stats.leaf_sah;
+    if (stats.leaf_count > 0) stats.avg_depth /= stats.leaf_count;
+    if (stats.inner_count > 0) stats.relative_overlap /= stats.inner_count;
+    if (epo) stats.epo = compute_epo(bvh, cost);
+    return stats;
+}
+
+static void print_histogram(const char* title, const std::vector<size_t>& histogram) {
+    size_t total = 0, max = 0;
+    for (auto count : histogram) {
+        total += count;
+        max = std::max(max, count);
+    }
+    std::cout << "  " << title << ":" << std::endl;
+    for (size_t i = 0; i < histogram.size(); i++) {
+        if (histogram[i] == 0) continue;
+        std::cout << "    " << std::setw(4) << i << ": "
+                  << std::setw(10) << histogram[i] << " "
+                  << std::setw(6) << std::fixed << std::setprecision(2) << 100.0 * histogram[i] / total << "% "
+                  << std::string(40 * histogram[i] / max, '#') << std::endl;
+    }
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+static void print_stats(const std::vector<BvhStats>& all_stats) {
+    // One column per BVH, so that builders can be compared side by side
+    const int label_width = 24;
+    size_t column_width = 16;
+    for (auto& stats : all_stats) column_width = std::max(column_width, stats.name.size() + 2);
+    auto row = [&] (const char* label, std::function<std::string (const BvhStats&)> value) {
+        std::cout << std::left << std::setw(label_width) << label << std::right;
+        for (auto& stats : all_stats) std::cout << std::setw(column_width) << value(stats);
+        std::cout << std::endl;
+    };
+    auto num = [] (double value) {
+        std::ostringstream os;
+        os << std::setprecision(5) << value;
+        return os.str();
+    };
+    auto percent = [] (double value) {
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(2) << 100.0 * value << "%";
+        return os.str();
+    };
+
+    row("",                    [&] (const BvhStats& s) { return s.name; });
+    row("Inner nodes",         [&] (const BvhStats& s) { return num(s.inner_count); });
+    row("Leaves",              [&] (const BvhStats& s) { return num(s.leaf_count); });
+    row("Triangles",           [&] (const BvhStats& s) { return num(s.unique_tris); });
+    row("References",          [&] (const BvhStats& s) { return num(s.tri_refs); });
+    row("Duplication",         [&] (const BvhStats& s) { return percent(s.unique_tris ? double(s.tri_refs) / s.unique_tris - 1.0 : 0.0); });
+    row("SAH cost",            [&] (const BvhStats& s) { return num(s.sah); });
+    row("  Inner nodes",       [&] (const BvhStats& s) { return num(s.inner_sah); });
+    row("  Leaves",            [&] (const BvhStats& s) { return num(s.leaf_sah); });
+    row("EPO",                 [&] (const BvhStats& s) { return s.epo < 0.0 ? std::string("-") : num(s.epo); });
+    row("Sibling overlap",     [&] (const BvhStats& s) { return num(s.overlap); });
+    row("  Per node",          [&] (const BvhStats& s) { return percent(s.relative_overlap); });
+    row("Empty child slots",   [&] (const BvhStats& s) { return num(s.empty_slots); });
+    row("Inner node fill",     [&] (const BvhStats& s) {
+        auto slots = double(s.inner_count) * (s.child_histogram.size() - 1);
+        return percent(slots > 0 ? 1.0 - s.empty_slots / slots : 0.0);
+    });
+    row("Triangles per leaf",  [&] (const BvhStats& s) { return num(s.leaf_count ? double(s.tri_refs) / s.leaf_count : 0.0); });
+    row("Padding slots",       [&] (const BvhStats& s) { return num(s.padding); });
+    row("Leaf fill",           [&] (const BvhStats& s) { return percent(s.tri_slots ? double(s.tri_refs) / s.tri_slots : 0.0); });
+    row("Average leaf depth",  [&] (const BvhStats& s) { return num(s.avg_depth); });
+    row("Max depth",           [&] (const BvhStats& s) { return num(s.max_depth); });
+
+    for (auto& stats : all_stats) {
+        std::cout << std::endl << stats.name << ":" << std::endl;
+        print_histogram("Leaves per depth", stats.depth_histogram);
+        print_histogram("Leaves per number of triangles", stats.leaf_histogram);
+        print_histogram("Inner nodes per number of children", stats.child_histogram);
+    }
+}
+
+inline void check_argument(int i, int argc, char** argv) {
+    if (i + 1 >= argc) {
+        std::cerr << "Missing argument for " << argv[i] << std::endl;
+        exit(1);
+    }
+}
+
+inline void usage() {
+    std::cout << "Usage: bvh_stats [options] file.bvh [file.bvh ...]\n"
+                 "Reports the quality of the BVHs in the given files, side by side, to compare builders.\n"
+                 "Available options:\n"
+                 "  -t       --type           Only analyzes the given block (bvh2, bvh4 or bvh8, default: every block in the files)\n"
+                 "  -ci      --node-cost      Sets the SAH cost of traversing an inner node (default: 1)\n"
+                 "  -ct      --tri-cost       Sets the SAH cost of intersecting a triangle (default: 1)\n"
+                 "  -p       --packets        Charges leaves per packet of triangles instead of per triangle (disabled by default)\n"
+                 "           --no-epo         Skips the computation of the EPO, which is slow on large scenes (disabled by default)\n";
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> files;
+    std::vector<BvhType> types;
+    CostFn cost { 1.0f, 1.0f, false };
+    bool epo = true;
+
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (arg[0] == '-') {
+            if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+                usage();
+                return 0;
+            } else if (!strcmp(arg, "-t") || !strcmp(arg, "--type")) {
+                check_argument(i, argc, argv);
+                auto type = argv[++i];
+                if (!strcmp(type, "bvh2"))      types.push_back(BvhType::BVH2);
+                else if (!strcmp(type, "bvh4")) types.push_back(BvhType::BVH4);
+                else if (!strcmp(type, "bvh8")) types.push_back(BvhType::BVH8_TRI4);
+                else {
+                    std::cerr << "Invalid BVH type '" << type << "'" << std::endl;
+                    return 1;
+                }
+            } else if (!strcmp(arg, "-ci") || !strcmp(arg, "--node-cost")) {
+                check_argument(i, argc, argv);
+                cost.node_cost = strtof(argv[++i], nullptr);
+            } else if (!strcmp(arg, "-ct") || !strcmp(arg, "--tri-cost")) {
+                check_argument(i, argc, argv);
+                cost.tri_cost = strtof(argv[++i], nullptr);
+            } else if (!strcmp(arg, "-p") || !strcmp(arg, "--packets")) {
+                cost.per_packet = true;
+            } else if (!strcmp(arg, "--no-epo")) {
+                epo = false;
+            } else {
+                std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                return 1;
+            }
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if (files.empty()) {
+        std::cerr << "No BVH file specified" << std::endl;
+        return 1;
+    }
+    if (types.empty())
+        types = { BvhType::BVH2, BvhType::BVH4, BvhType::BVH8_TRI4 };
+
+    std::vector<BvhStats> all_stats;
+    for (auto& file : files) {
+        bool found = false;
+        for (auto type : types) {
+            StatsBvh bvh(0, 0);
+            if (!load_stats_bvh(file, type, bvh)) continue;
+            auto name = file + (type == BvhType::BVH2 ? ":bvh2" : type == BvhType::BVH4 ? ":bvh4" : ":bvh8");
+            all_stats.push_back(compute_stats(name, bvh, cost, epo));
+            found = true;
+        }
+        if (!found) {
+            std::cerr << "Cannot load BVH file '" << file << "'" << std::endl;
+            return 1;
+        }
+    }
+
+    print_stats(all_stats);
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef HIT_FILE_H
+#define HIT_FILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/// Result of the traversal for one ray, as in the Hit1AoS layout.
+struct HitRecord {
+    int32_t tri_id;     ///< Index of the triangle that was hit, or -1 for a miss
+    float t;            ///< Distance along the ray
+    float u, v;         ///< Barycentric coordinates of the hit point
+};
+
+/// Hit files start with this header, followed by one HitRecord per ray, in the order of the ray file.
+/// Files without this header are legacy hit files: arrays of distances (one float per ray).
+struct HitFileHeader {
+    uint32_t magic;                 ///< Must be HitFileHeader::magic_number
+    uint32_t version;               ///< Must be HitFileHeader::current_version
+    uint64_t hit_count;             ///< Number of hits in the file
+    uint32_t flags;                 ///< Combination of HitFileHeader::Flags
+    uint8_t  pad[12];
+
+    enum : uint32_t {
+        magic_number    = 0x53544948,   // "HITS"
+        current_version = 1
+    };
+
+    enum Flags : uint32_t {
+        ANY_HIT   = 1,  ///< The hits come from an any-hit traversal: only tri_id >= 0 is meaningful
+        DIST_ONLY = 2   ///< Only the distances are known (set when loading legacy files)
+    };
+};
+
+static_assert(sizeof(HitFileHeader) == 32, "Hit file headers must be 32 bytes long");
+
+inline bool write_hits(const std::string& filename, const std::vector<HitRecord>& hits, bool any_hit) {
+    std::ofstream os(filename, std::ofstream::binary);
+    if (!os) return false;
+
+    HitFileHeader header;
+    memset(&header, 0, sizeof(HitFileHeader));
+    header.magic     = HitFileHeader::magic_number;
+    header.version   = HitFileHeader::current_version;
+    header.hit_count = hits.size();
+    header.flags     = any_hit ? uint32_t(HitFileHeader::ANY_HIT) : 0;
+    os.write((const char*)&header, sizeof(HitFileHeader));
+    os.write((const char*)hits.data(), hits.size() * sizeof(HitRecord));
+    return bool(os);
+}
+
+/// Loads a hit file, either with a header (see HitFileHeader), or in the legacy format.
+/// Returns the flags of the file, or -1 on failure.
+inline int load_hits(const std::string& filename, std::vector<HitRecord>& hits) {
+    std::ifstream in(filename, std::ifstream::binary);
+    if (!in) return -1;
+
+    in.seekg(0, std::ios_base::end);
+    size_t size = in.tellg();
+    in.seekg(0, std::ios_base::beg);
+
+    HitFileHeader header;
+    memset(&header, 0, sizeof(HitFileHeader));
+    if (size >= sizeof(HitFileHeader))
+        in.read((char*)&header, sizeof(HitFileHeader));
+
+    if (header.magic == HitFileHeader::magic_number) {
+        if (header.version != HitFileHeader::current_version ||
+            sizeof(HitFileHeader) + header.hit_count * sizeof(HitRecord) > size)
+            return -1;
+        hits.resize(header.hit_count);
+        if (!in.read((char*)hits.data(), hits.size() * sizeof(HitRecord))) return -1;
+        return header.flags;
+    }
+
+    if (size % sizeof(float) != 0) return -1;
+    std::vector<float> dists(size / sizeof(float));
+    in.seekg(0, std::ios_base::beg);
+    if (!in.read((char*)dists.data(), dists.size() * sizeof(float))) return -1;
+    hits.resize(dists.size());
+    for (size_t i = 0; i < dists.size(); i++)
+        hits[i] = HitRecord { -1, dists[i], 0.0f, 0.0f };
+    return HitFileHeader::DIST_ONLY;
+}
+
+#endif // HIT_FILE_H
@@ -2,13 +2,19 @@
 #define LOAD_BVH_H
 
 #include <fstream>
+#include <limits>
+#include <algorithm>
 #include <anydsl_runtime.hpp>
 #include "traversal.h"
 
 enum class BvhType : uint32_t {
     BVH2 = 1,
     BVH4 = 2,
-    BVH8_TRI4 = 3
+    BVH8_TRI4 = 3,
+    // Optional blocks with the exact vertices of the triangles of the BVH4 and BVH8_TRI4 blocks,
+    // in the same order (no nodes). They are only needed by the watertight intersection test.
+    BVH4_VERTICES = 4,
+    BVH8_TRI4_VERTICES = 5
 };
 
 namespace detail {
@@ -72,4 +78,66 @@ inline bool load_bvh(const std::string& filename,
     return true;
 }
 
+// Loads the triangle vertices stored in an optional vertex block (on the host)
+template <typename Tri>
+inline bool load_bvh_vertices(const std::string& filename,
+                              anydsl::Array<Tri>& tris,
+                              BvhType block_type) {
+    std::ifstream in(filename, std::ifstream::binary);
+    if (!in || !detail::check_header(in) || !detail::locate_block(in, block_type))
+        return false;
+
+    detail::BvhHeader header;
+    in.read((char*)&header, sizeof(detail::BvhHeader));
+    tris = std::move(anydsl::Array<Tri>(header.tri_count));
+    in.read((char*)tris.data(), sizeof(Tri) * header.tri_count);
+    return static_cast<bool>(in);
+}
+
+// Sets the parent of every node, and sorts the children of every node along the axis where their
+// centers are the most spread out. This is required by the stackless traversal kernels.
+template <typename Node>
+inline void link_bvh_nodes(Node* nodes, size_t node_count) {
+    const int N = sizeof(nodes[0].child) / sizeof(nodes[0].child[0]);
+    for (size_t i = 0; i < node_count; i++)
+        nodes[i].parent = 0;
+
+    for (size_t i = 0; i < node_count; i++) {
+        auto& node = nodes[i];
+
+        int count = 0;
+        while (count < N && node.child[count] != 0) count++;
+
+        // Find the axis where the children are the most spread out
+        float center[3][N];
+        float extent[3] = { 0.0f, 0.0f, 0.0f };
+        for (int k = 0; k < 3; k++) {
+            float lo = std::numeric_limits<float>::max(), hi = -std::numeric_limits<float>::max();
+            for (int j = 0; j < count; j++) {
+                center[k][j] = node.bounds[k * 2 + 0][j] + node.bounds[k * 2 + 1][j];
+                lo = std::min(lo, center[k][j]);
+                hi = std::max(hi, center[k][j]);
+            }
+            if (count > 0) extent[k] = hi - lo;
+        }
+        int axis = 0;
+        if (extent[1] > extent[axis]) axis = 1;
+        if (extent[2] > extent[axis]) axis = 2;
+        node.axis = axis;
+
+        // Sort the children along that axis (insertion sort, empty children stay at the end)
+        for (int j = 1; j < count; j++) {
+            for (int l = j; l > 0 && center[axis][l] < center[axis][l - 1]; l--) {
+                for (int k = 0; k < 6; k++) std::swap(node.bounds[k][l], node.bounds[k][l - 1]);
+                for (int k = 0; k < 3; k++) std::swap(center[k][l], center[k][l - 1]);
+                std::swap(node.child[l], node.child[l - 1]);
+            }
+        }
+
+        for (int j = 0; j < count; j++) {
+            if (node.child[j] > 0) nodes[node.child[j] - 1].parent = i + 1;
+        }
+    }
+}
+
 #endif // LOAD_BVH_H
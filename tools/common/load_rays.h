@@ -2,12 +2,19 @@
 #define LOAD_RAYS_H
 
 #include <fstream>
+#include <vector>
 #include <anydsl_runtime.hpp>
+#include "ray_file.h"
 
 template <typename Ray>
 struct RayTraits {};
 
+/// True for ray types stored in memory exactly as in ray files (see RayFileHeader).
+template <typename Ray>
+struct IsRayFileLayout { enum { value = 0 }; };
+
 struct Ray1AoS;
+template <> struct IsRayFileLayout<Ray1AoS> { enum { value = 1 }; };
 template <>
 struct RayTraits<Ray1AoS> {
     enum { RayPerPacket = 1 };
@@ -24,6 +31,7 @@ struct RayTraits<Ray1AoS> {
 };
 
 struct Ray8SoA;
+template <> struct IsRayFileLayout<Ray8SoA> { enum { value = 1 }; };
 template <>
 struct RayTraits<Ray8SoA> {
     enum { RayPerPacket = 8 };
@@ -39,34 +47,142 @@ struct RayTraits<Ray8SoA> {
     }
 };
 
+/// Information about the contents of a ray file.
+struct RayFileInfo {
+    size_t ray_count;               ///< Number of rays in the file (rays may be added to fill the last packet)
+    bool has_extents;               ///< True if the rays have their own tmin and tmax
+    std::vector<uint32_t> masks;    ///< Masks of the rays (empty if the file has none)
+};
+
+namespace detail {
+
+// Headerless files: the number of rays is rounded down to a multiple of the packet size
+template <typename Ray>
+inline bool load_legacy_rays(std::ifstream& in, size_t size, anydsl::Array<Ray>& host_rays, float tmin, float tmax, RayFileInfo& info) {
+    if (size % (sizeof(float) * 6) != 0) return false;
+
+    auto rays_per_packet = RayTraits<Ray>::RayPerPacket;
+    auto packet_count = size / (rays_per_packet * sizeof(float) * 6);
+    host_rays = std::move(anydsl::Array<Ray>(packet_count));
+
+    std::vector<float> org_dirs(packet_count * rays_per_packet * 6);
+    if (!in.read((char*)org_dirs.data(), org_dirs.size() * sizeof(float))) return false;
+    for (size_t i = 0; i < packet_count; i++) {
+        for (int j = 0; j < rays_per_packet; j++)
+            RayTraits<Ray>::write_ray(&org_dirs[(i * rays_per_packet + j) * 6], tmin, tmax, j, host_rays[i]);
+    }
+
+    info.ray_count = packet_count * rays_per_packet;
+    info.has_extents = false;
+    return true;
+}
+
+template <typename Ray>
+inline bool load_versioned_rays(std::ifstream& in, size_t size, const RayFileHeader& header, anydsl::Array<Ray>& host_rays, float tmin, float tmax, const uint32_t* filter, RayFileInfo& info) {
+    if (header.version != RayFileHeader::current_version) return false;
+    auto width = header.width;
+    if (width != 1 && width != 4 && width != 8 && width != 16) return false;
+
+    auto file_packets = (header.ray_count + width - 1) / width;
+    auto data_size = file_packets * ray_packet_floats(width) * sizeof(float);
+    if (header.data_offset + data_size > size) return false;
+
+    std::vector<uint32_t> masks;
+    if (header.flags & RayFileHeader::HAS_MASKS) {
+        masks.resize(header.ray_count);
+        in.seekg(header.mask_offset);
+        if (!in.read((char*)masks.data(), masks.size() * sizeof(uint32_t))) return false;
+    } else if (filter) {
+        return false;
+    }
+
+    // Indices of the rays to load, when only some of them are selected
+    std::vector<size_t> selected;
+    if (filter) {
+        for (size_t i = 0; i < header.ray_count; i++) {
+            if (masks[i] == *filter) selected.push_back(i);
+        }
+    }
+    auto ray_count = filter ? selected.size() : header.ray_count;
+
+    auto rays_per_packet = RayTraits<Ray>::RayPerPacket;
+    auto packet_count = (ray_count + rays_per_packet - 1) / rays_per_packet;
+    host_rays = std::move(anydsl::Array<Ray>(packet_count));
+
+    in.seekg(header.data_offset);
+    if (!filter && IsRayFileLayout<Ray>::value && width == rays_per_packet) {
+        // Same layout in the file and in memory: read the packets directly (padding included)
+        if (!in.read((char*)host_rays.data(), data_size)) return false;
+        if (!(header.flags & RayFileHeader::HAS_EXTENTS)) {
+            for (size_t i = 0; i < ray_count; i++) {
+                float org_dir[6], ray_tmin, ray_tmax;
+                read_packet_ray((const float*)host_rays.data(), width, i, org_dir, ray_tmin, ray_tmax);
+                write_packet_ray((float*)host_rays.data(), width, i, org_dir, tmin, tmax);
+            }
+        }
+    } else {
+        std::vector<float> packets(file_packets * ray_packet_floats(width));
+        if (!in.read((char*)packets.data(), data_size)) return false;
+        for (size_t i = 0; i < packet_count * rays_per_packet; i++) {
+            float org_dir[6] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+            float ray_tmin = 1.0f, ray_tmax = 0.0f;
+            if (i < ray_count) {
+                read_packet_ray(packets.data(), width, filter ? selected[i] : i, org_dir, ray_tmin, ray_tmax);
+                if (!(header.flags & RayFileHeader::HAS_EXTENTS)) {
+                    ray_tmin = tmin;
+                    ray_tmax = tmax;
+                }
+            }
+            RayTraits<Ray>::write_ray(org_dir, ray_tmin, ray_tmax, i % rays_per_packet, host_rays[i / rays_per_packet]);
+        }
+    }
+
+    info.ray_count = ray_count;
+    info.has_extents = header.flags & RayFileHeader::HAS_EXTENTS;
+    info.masks.clear();
+    if (filter) {
+        info.masks.resize(ray_count, *filter);
+    } else {
+        info.masks = std::move(masks);
+    }
+    return true;
+}
+
+} // namespace detail
+
+/// Loads a ray file, either with a header (see RayFileHeader), or in the legacy format.
+/// The given tmin and tmax are used for the rays that do not have their own.
+/// If a filter is given, only the rays with that mask are loaded (the file must have masks).
 template <typename Ray>
 inline bool load_rays(const std::string& filename,
                       anydsl::Array<Ray>& rays,
                       float tmin, float tmax,
-                      bool use_gpu) {
+                      bool use_gpu,
+                      RayFileInfo* info = nullptr,
+                      const uint32_t* filter = nullptr) {
     std::ifstream in(filename, std::ifstream::binary);
     if (!in) return false;
 
     in.seekg(0, std::ios_base::end);
-    auto size = in.tellg();
+    size_t size = in.tellg();
     in.seekg(0, std::ios_base::beg);
 
-    if (size % (sizeof(float) * 6) != 0) return false;
+    RayFileHeader header;
+    memset(&header, 0, sizeof(RayFileHeader));
+    if (size >= sizeof(RayFileHeader))
+        in.read((char*)&header, sizeof(RayFileHeader));
+    in.seekg(0, std::ios_base::beg);
 
-    auto rays_per_packet = RayTraits<Ray>::RayPerPacket;
-    auto ray_count = size / (rays_per_packet * sizeof(float) * 6);
-    anydsl::Array<Ray> host_rays(ray_count);
-
-    for (size_t i = 0; i < ray_count; i++) {
-        for (int j = 0; j < rays_per_packet; j++) {
-            float org_dir[6];
-            in.read((char*)org_dir, sizeof(float) * 6);
-            RayTraits<Ray>::write_ray(org_dir, tmin, tmax, j, host_rays[i]);
-        }
-    }
+    RayFileInfo file_info;
+    anydsl::Array<Ray> host_rays;
+    bool ok = header.magic == RayFileHeader::magic_number
+        ? detail::load_versioned_rays(in, size, header, host_rays, tmin, tmax, filter, file_info)
+        : !filter && detail::load_legacy_rays(in, size, host_rays, tmin, tmax, file_info);
+    if (!ok) return false;
+    if (info) *info = std::move(file_info);
 
     if (use_gpu) {
-        rays = std::move(anydsl::Array<Ray>(anydsl::Platform::Cuda, anydsl::Device(0), ray_count));
+        rays = std::move(anydsl::Array<Ray>(anydsl::Platform::Cuda, anydsl::Device(0), host_rays.size()));
         anydsl::copy(host_rays, rays);
     } else {
         rays = std::move(host_rays);
@@ -0,0 +1,126 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <string>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/// Hardware performance counters of the calling thread, read with the Linux perf_event interface.
+/// Counters that are not supported by the machine (or not allowed by the kernel) are ignored.
+/// Only user-space events are counted, which works with the default perf_event_paranoid setting.
+class PerfCounters {
+public:
+    struct Counter {
+        std::string name;
+        uint64_t value;     ///< Accumulated value, scaled when the counter was multiplexed
+        bool valid;         ///< True if the counter could be opened
+        bool counted;       ///< True if the counter was scheduled on the hardware at least once
+    };
+
+    PerfCounters() {
+#ifdef __linux__
+        add("cycles",              PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        add("instructions",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        add("L1D misses",          PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS));
+        add("LLC misses",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        add("branch mispredicts",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (auto fd : fds_) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator = (const PerfCounters&) = delete;
+
+    /// Returns true if at least one counter is available.
+    bool available() const { return leader_ >= 0; }
+
+    /// Starts counting (the values are accumulated across calls to start() and stop()).
+    void start() {
+#ifdef __linux__
+        if (leader_ < 0) return;
+        read_group(start_);
+        ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    /// Stops counting, and adds the values since the last call to start() to the counters.
+    void stop() {
+#ifdef __linux__
+        if (leader_ < 0) return;
+        ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        std::vector<uint64_t> end;
+        read_group(end);
+        if (end.size() != start_.size()) return;
+
+        // The group is multiplexed as a whole when there are not enough hardware counters
+        auto enabled = end[1] - start_[1];
+        auto running = end[2] - start_[2];
+        // A group that never ran has no meaningful values, and its counters stay uncounted
+        if (running == 0) return;
+        auto scale = double(enabled) / double(running);
+        for (size_t i = 0, j = 3; i < counters_.size(); i++) {
+            if (!counters_[i].valid) continue;
+            counters_[i].value += uint64_t((end[j] - start_[j]) * scale);
+            counters_[i].counted = true;
+            j++;
+        }
+#endif
+    }
+
+    const std::vector<Counter>& counters() const { return counters_; }
+
+private:
+#ifdef __linux__
+    static uint64_t cache_config(uint64_t cache, uint64_t op, uint64_t result) {
+        return cache | (op << 8) | (result << 16);
+    }
+
+    void add(const char* name, uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(perf_event_attr));
+        attr.size           = sizeof(perf_event_attr);
+        attr.type           = type;
+        attr.config         = config;
+        attr.disabled       = leader_ < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        int fd = syscall(__NR_perf_event_open, &attr, 0, -1, leader_, 0);
+        counters_.push_back(Counter { name, 0, fd >= 0, false });
+        if (fd < 0) return;
+        if (leader_ < 0) leader_ = fd;
+        fds_.push_back(fd);
+    }
+
+    // Reads the number of counters, the enabled and running times, and the values of the group
+    void read_group(std::vector<uint64_t>& values) {
+        values.resize(3 + fds_.size());
+        auto size = sizeof(uint64_t) * values.size();
+        if (read(leader_, values.data(), size) != ssize_t(size))
+            values.clear();
+    }
+
+    std::vector<int> fds_;
+    std::vector<uint64_t> start_;
+#endif
+    std::vector<Counter> counters_;
+    int leader_ = -1;
+};
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,148 @@
+#ifndef RAY_FILE_H
+#define RAY_FILE_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+/// Ray files start with this header, and store their rays in packets of a fixed width
+/// (1 for the Ray1AoS layout, or 4, 8, and 16 for the RayNSoA layouts). The packets are stored
+/// exactly as in memory, right after the header, so that they can be loaded without conversion
+/// when the width matches. The last packet is padded with empty rays (tmin > tmax).
+/// If present, masks follow the packets, as one 32-bit value per ray (without padding),
+/// starting at the next multiple of 64 bytes.
+/// Files without this header are legacy ray files: arrays of origins and directions (6 floats per ray).
+struct RayFileHeader {
+    uint32_t magic;                 ///< Must be RayFileHeader::magic_number
+    uint32_t version;               ///< Must be RayFileHeader::current_version
+    uint64_t ray_count;             ///< Number of rays, without padding
+    uint32_t width;                 ///< Number of rays per packet (1, 4, 8, or 16)
+    uint32_t flags;                 ///< Combination of RayFileHeader::Flags
+    uint64_t data_offset;           ///< Offset of the packets from the beginning of the file
+    uint64_t mask_offset;           ///< Offset of the masks from the beginning of the file (0 if there are none)
+    uint8_t  pad[24];
+
+    enum : uint32_t {
+        magic_number    = 0x53594152,   // "RAYS"
+        current_version = 1
+    };
+
+    enum Flags : uint32_t {
+        HAS_EXTENTS = 1,    ///< The tmin and tmax values of the rays are meaningful
+        HAS_MASKS   = 2     ///< The file contains masks (e.g. the kind or depth of the rays)
+    };
+};
+
+static_assert(sizeof(RayFileHeader) == 64, "Ray file headers must be 64 bytes long");
+
+/// Mask of the rays captured from the renderer: depth of the path vertex that emits the ray
+/// (0 for primary rays) in the low 16 bits, and bit 16 set for any-hit (shadow) rays.
+inline uint32_t ray_capture_mask(uint32_t depth, bool any_hit) {
+    return (depth & 0xFFFF) | (any_hit ? 0x10000 : 0);
+}
+
+namespace detail {
+
+inline size_t align_ray_data(size_t offset) { return (offset + 63) & ~size_t(63); }
+
+/// Size of a packet of the given width, in floats.
+inline size_t ray_packet_floats(uint32_t width) { return width * 8; }
+
+/// Reads one ray from packets of the given width. The AoS layout (width 1) is
+/// origin, tmin, direction, tmax. The SoA layouts are origins, directions, tmins, tmaxs.
+inline void read_packet_ray(const float* packets, uint32_t width, size_t i, float* org_dir, float& tmin, float& tmax) {
+    auto packet = packets + (i / width) * ray_packet_floats(width);
+    if (width == 1) {
+        std::copy(packet + 0, packet + 3, org_dir);
+        std::copy(packet + 4, packet + 7, org_dir + 3);
+        tmin = packet[3];
+        tmax = packet[7];
+    } else {
+        auto j = i % width;
+        for (int k = 0; k < 6; k++)
+            org_dir[k] = packet[k * width + j];
+        tmin = packet[6 * width + j];
+        tmax = packet[7 * width + j];
+    }
+}
+
+inline void write_packet_ray(float* packets, uint32_t width, size_t i, const float* org_dir, float tmin, float tmax) {
+    auto packet = packets + (i / width) * ray_packet_floats(width);
+    if (width == 1) {
+        std::copy(org_dir + 0, org_dir + 3, packet);
+        std::copy(org_dir + 3, org_dir + 6, packet + 4);
+        packet[3] = tmin;
+        packet[7] = tmax;
+    } else {
+        auto j = i % width;
+        for (int k = 0; k < 6; k++)
+            packet[k * width + j] = org_dir[k];
+        packet[6 * width + j] = tmin;
+        packet[7 * width + j] = tmax;
+    }
+}
+
+} // namespace detail
+
+/// Writes ray files incrementally. The header is written when the file is closed.
+class RayFileWriter {
+public:
+    RayFileWriter(std::ofstream& os, uint32_t width, uint32_t flags)
+        : os_(os), width_(width), flags_(flags), ray_count_(0), packet_(detail::ray_packet_floats(width))
+    {
+        RayFileHeader header;
+        memset(&header, 0, sizeof(RayFileHeader));
+        os_.write((const char*)&header, sizeof(RayFileHeader));
+    }
+
+    void add_ray(const float* org_dir, float tmin, float tmax, uint32_t mask = 0) {
+        detail::write_packet_ray(packet_.data(), width_, ray_count_ % width_, org_dir, tmin, tmax);
+        if (flags_ & RayFileHeader::HAS_MASKS) masks_.push_back(mask);
+        if (++ray_count_ % width_ == 0)
+            os_.write((const char*)packet_.data(), packet_.size() * sizeof(float));
+    }
+
+    /// Pads the last packet, writes the masks and the header, and returns true on success.
+    bool close() {
+        if (ray_count_ % width_ != 0) {
+            const float empty[6] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+            for (auto i = ray_count_ % width_; i < width_; i++)
+                detail::write_packet_ray(packet_.data(), width_, i, empty, 1.0f, 0.0f);
+            os_.write((const char*)packet_.data(), packet_.size() * sizeof(float));
+        }
+
+        RayFileHeader header;
+        memset(&header, 0, sizeof(RayFileHeader));
+        header.magic       = RayFileHeader::magic_number;
+        header.version     = RayFileHeader::current_version;
+        header.ray_count   = ray_count_;
+        header.width       = width_;
+        header.flags       = flags_;
+        header.data_offset = sizeof(RayFileHeader);
+        if (flags_ & RayFileHeader::HAS_MASKS) {
+            size_t end = os_.tellp();
+            header.mask_offset = detail::align_ray_data(end);
+            std::vector<char> zeros(header.mask_offset - end, 0);
+            os_.write(zeros.data(), zeros.size());
+            os_.write((const char*)masks_.data(), masks_.size() * sizeof(uint32_t));
+        }
+        os_.seekp(0);
+        os_.write((const char*)&header, sizeof(RayFileHeader));
+        os_.flush();
+        return bool(os_);
+    }
+
+    size_t ray_count() const { return ray_count_; }
+
+private:
+    std::ofstream& os_;
+    uint32_t width_;
+    uint32_t flags_;
+    size_t ray_count_;
+    std::vector<float> packet_;
+    std::vector<uint32_t> masks_;
+};
+
+#endif // RAY_FILE_H
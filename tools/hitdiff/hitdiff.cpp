@@ -0,0 +1,277 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <png.h>
+
+#include "hit_file.h"
+
+static void write_to_stream(png_structp png_ptr, png_bytep data, png_size_t length) {
+    png_voidp a = png_get_io_ptr(png_ptr);
+    ((std::ostream*)a)->write((const char*)data, length);
+}
+
+static void flush_stream(png_structp) {
+    // Nothing to do
+}
+
+inline void check_argument(int i, int argc, char** argv) {
+    if (i + 1 >= argc) {
+        std::cerr << "Missing argument for " << argv[i] << std::endl;
+        exit(1);
+    }
+}
+
+inline void usage() {
+    std::cout << "Usage: hitdiff [options] reference test\n"
+                 "Compares two hit files (written with -hits by bench_traversal or bench_embree).\n"
+                 "Legacy files (written with -o) only contain distances, and only the distances are compared.\n"
+                 "Returns 0 if the hits match, 1 on error, and 2 if there are mismatches.\n"
+                 "Available options:\n"
+                 "  -t       --t-tolerance    Sets the relative tolerance on the distances (default: 1e-4)\n"
+                 "  -uv      --uv-tolerance   Sets the absolute tolerance on the barycentric coordinates (default: 1e-3)\n"
+                 "  -any                      Only compares whether the rays hit something (automatic for any-hit files)\n"
+                 "           --strict         Counts hits on different triangles at the same distance as mismatches\n"
+                 "                            (they are expected on shared edges, disabled by default)\n"
+                 "  -l       --list           Prints the given number of mismatches (default: 10)\n"
+                 "  -m       --mask           Writes an image of the mismatches to the given PNG file\n"
+                 "  -sx      --width          Sets the width of the image (default: 1024)\n"
+                 "  -sy      --height         Sets the height of the image (default: 1024)\n";
+}
+
+enum Category {
+    MATCH,
+    SAME_DIST,      // Different triangles, same distance
+    LOST_HIT,       // Hit in the reference, miss in the test
+    EXTRA_HIT,      // Miss in the reference, hit in the test
+    DIST,           // Distances differ
+    UV,             // Barycentric coordinates differ
+    CATEGORY_COUNT
+};
+
+static const char* category_names[] = {
+    "match",
+    "different triangle, same distance",
+    "hit in the reference only",
+    "hit in the test only",
+    "different distance",
+    "different barycentric coordinates"
+};
+
+// Colors of the categories in the mask image (matching hits are gray, matching misses black)
+static const uint8_t category_colors[][3] = {
+    {  64,  64,  64 },
+    { 255, 255,   0 },
+    { 255,   0,   0 },
+    {   0, 255,   0 },
+    { 255,   0, 255 },
+    {   0, 128, 255 }
+};
+
+static float relative_error(float a, float b) {
+    auto d = std::fabs(a - b);
+    auto m = std::max(std::fabs(a), std::fabs(b));
+    return m > 0.0f ? d / m : d;
+}
+
+static bool write_mask(const std::string& file, const std::vector<Category>& categories, const std::vector<HitRecord>& ref, int width, int height) {
+    std::ofstream png_file(file, std::ofstream::binary);
+    if (!png_file)
+        return false;
+
+    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png_ptr) {
+        return false;
+    }
+
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_write_struct(&png_ptr, nullptr);
+        return false;
+    }
+
+    std::vector<uint8_t> row(width * 4);
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        return false;
+    }
+
+    png_set_write_fn(png_ptr, &png_file, write_to_stream, flush_stream);
+
+    png_set_IHDR(png_ptr, info_ptr, width, height,
+                 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+    png_write_info(png_ptr, info_ptr);
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            auto i = y * width + x;
+            auto category = categories[i];
+            auto miss = category == MATCH && ref[i].tri_id < 0;
+            for (int k = 0; k < 3; k++)
+                row[x * 4 + k] = miss ? 0 : category_colors[category][k];
+            row[x * 4 + 3] = 255;
+        }
+        png_write_row(png_ptr, row.data());
+    }
+
+    png_write_end(png_ptr, info_ptr);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return bool(png_file);
+}
+
+int main(int argc, char** argv) {
+    float t_tolerance = 1e-4f;
+    float uv_tolerance = 1e-3f;
+    bool any_hit = false;
+    bool strict = false;
+    int list = 10;
+    std::string mask_file;
+    int width = 1024;
+    int height = 1024;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++) {
+        auto arg = argv[i];
+        if (arg[0] == '-') {
+            if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
+                usage();
+                return 0;
+            } else if (!strcmp(arg, "-t") || !strcmp(arg, "--t-tolerance")) {
+                check_argument(i, argc, argv);
+                t_tolerance = strtof(argv[++i], nullptr);
+            } else if (!strcmp(arg, "-uv") || !strcmp(arg, "--uv-tolerance")) {
+                check_argument(i, argc, argv);
+                uv_tolerance = strtof(argv[++i], nullptr);
+            } else if (!strcmp(arg, "-any")) {
+                any_hit = true;
+            } else if (!strcmp(arg, "--strict")) {
+                strict = true;
+            } else if (!strcmp(arg, "-l") || !strcmp(arg, "--list")) {
+                check_argument(i, argc, argv);
+                list = strtol(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-m") || !strcmp(arg, "--mask")) {
+                check_argument(i, argc, argv);
+                mask_file = argv[++i];
+            } else if (!strcmp(arg, "-sx") || !strcmp(arg, "--width")) {
+                check_argument(i, argc, argv);
+                width = strtol(argv[++i], nullptr, 10);
+            } else if (!strcmp(arg, "-sy") || !strcmp(arg, "--height")) {
+                check_argument(i, argc, argv);
+                height = strtol(argv[++i], nullptr, 10);
+            } else {
+                std::cerr << "Unknown option '" << arg << "'" << std::endl;
+                return 1;
+            }
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    if (files.size() < 2) {
+        std::cerr << "Missing reference or test file" << std::endl;
+        return 1;
+    }
+    if (files.size() > 2) {
+        std::cerr << "Too many arguments" << std::endl;
+        return 1;
+    }
+
+    std::vector<HitRecord> ref, test;
+    auto ref_flags  = load_hits(files[0], ref);
+    auto test_flags = load_hits(files[1], test);
+    if (ref_flags < 0 || test_flags < 0) {
+        std::cerr << "Cannot load hit file '" << files[ref_flags < 0 ? 0 : 1] << "'" << std::endl;
+        return 1;
+    }
+
+    // Legacy files do not say which rays hit, and any-hit traversals stop at an arbitrary hit
+    auto dist_only = (ref_flags | test_flags) & HitFileHeader::DIST_ONLY;
+    any_hit |= ((ref_flags | test_flags) & HitFileHeader::ANY_HIT) != 0;
+    if (dist_only && any_hit) {
+        std::cerr << "Files with distances only cannot be compared with any-hit results" << std::endl;
+        return 1;
+    }
+
+    auto count = std::min(ref.size(), test.size());
+    if (ref.size() != test.size())
+        std::cerr << "The files have different numbers of hits (" << ref.size() << " and " << test.size()
+                  << "), only the first " << count << " will be compared" << std::endl;
+
+    std::vector<Category> categories(count, MATCH);
+    size_t counts[CATEGORY_COUNT] = {};
+    size_t hits = 0;
+    double sum_t_error = 0.0;
+    float max_t_error = 0.0f, max_uv_error = 0.0f;
+    int listed = 0;
+    for (size_t i = 0; i < count; i++) {
+        auto& a = ref[i];
+        auto& b = test[i];
+        auto t_error = relative_error(a.t, b.t);
+
+        Category category = MATCH;
+        if (dist_only) {
+            if (t_error > t_tolerance) category = DIST;
+        } else if ((a.tri_id >= 0) != (b.tri_id >= 0)) {
+            category = a.tri_id >= 0 ? LOST_HIT : EXTRA_HIT;
+        } else if (a.tri_id >= 0 && !any_hit) {
+            auto uv_error = std::max(std::fabs(a.u - b.u), std::fabs(a.v - b.v));
+            if (t_error > t_tolerance)
+                category = DIST;
+            else if (a.tri_id != b.tri_id)
+                category = SAME_DIST;
+            else if (uv_error > uv_tolerance)
+                category = UV;
+            if (a.tri_id == b.tri_id)
+                max_uv_error = std::max(max_uv_error, uv_error);
+        }
+
+        // Distance errors are only meaningful for rays that hit the same triangle
+        if (!any_hit && (dist_only || (a.tri_id >= 0 && a.tri_id == b.tri_id))) {
+            sum_t_error += t_error;
+            max_t_error = std::max(max_t_error, t_error);
+            hits++;
+        }
+
+        categories[i] = category;
+        counts[category]++;
+        if (category != MATCH && (strict || category != SAME_DIST) && listed < list) {
+            std::cout << "Ray " << i << ": " << category_names[category]
+                      << " (reference: " << a.tri_id << ", t = " << a.t << ", u = " << a.u << ", v = " << a.v
+                      << "; test: " << b.tri_id << ", t = " << b.t << ", u = " << b.u << ", v = " << b.v << ")" << std::endl;
+            listed++;
+        }
+    }
+
+    std::cout << count << " hit(s) compared";
+    if (dist_only) std::cout << " (distances only)";
+    if (any_hit)   std::cout << " (hit or miss only)";
+    std::cout << std::endl;
+    for (int i = 0; i < CATEGORY_COUNT; i++) {
+        if (counts[i] == 0 && i != MATCH) continue;
+        std::cout << counts[i] << " " << category_names[i] << " (" << 100.0 * counts[i] / std::max(count, size_t(1)) << "%)" << std::endl;
+    }
+    if (hits > 0) {
+        std::cout << "# Mean relative distance error: " << sum_t_error / hits << std::endl;
+        std::cout << "# Max relative distance error: " << max_t_error << std::endl;
+        if (!dist_only)
+            std::cout << "# Max barycentric coordinate error: " << max_uv_error << std::endl;
+    }
+
+    if (mask_file != "") {
+        if (size_t(width) * size_t(height) > count) {
+            std::cerr << "Not enough hits for a " << width << "x" << height << " image" << std::endl;
+            return 1;
+        }
+        if (!write_mask(mask_file, categories, ref, width, height)) {
+            std::cerr << "Cannot write mask image" << std::endl;
+            return 1;
+        }
+    }
+
+    auto mismatches = count - counts[MATCH] - (strict ? 0 : counts[SAME_DIST]);
+    return mismatches > 0 || ref.size() != test.size() ? 2 : 0;
+}
@@ -3,20 +3,124 @@
 #include <memory>
 #include <cmath>
 #include <random>
+#include <algorithm>
 #include <cstring>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
 
 #include "traversal.h"
 #include "load_bvh.h"
 #include "load_rays.h"
+#include "ray_file.h"
 #include "float3.h"
 #include "bbox.h"
 
+// Ray, as stored in ray files
+struct RayData {
+    float3 org, dir;
+};
+
 class RayGen {
 public:
     virtual ~RayGen() {}
-    virtual void generate_rays(std::ofstream&) = 0;
+    /// Returns the number of items (pixels, hit points, bundles, ...) for which rays are generated.
+    virtual size_t item_count() const = 0;
+    /// Generates the rays for a range of items, using the given random generator.
+    virtual void generate_rays(size_t, size_t, std::mt19937_64&, std::vector<RayData>&) const = 0;
+    /// Returns true and sets the extents shared by all the rays if they have some (otherwise, rays are unbounded).
+    virtual bool extents(float&, float&) const { return false; }
 };
 
+// Scalar closest-hit traversal of a BVH4, used to find the surfaces hit by rays
+class BvhTracer {
+public:
+    BvhTracer(const anydsl::Array<Bvh4Node>& nodes, const anydsl::Array<Bvh4Tri>& tris)
+        : nodes_(nodes), tris_(tris)
+    {}
+
+    /// Finds the closest hit in [tmin, tmax], and returns its distance and its geometric normal (not normalized).
+    bool intersect(const float3& org, const float3& dir, float tmin, float tmax, float& t, float3& n) const {
+        auto inv_dir = float3(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+        bool found = false;
+
+        // The stack grows with the depth of the BVH (one per thread, to avoid allocating at every call)
+        thread_local std::vector<int> stack;
+        stack.clear();
+        stack.push_back(1);
+        while (!stack.empty()) {
+            int id = stack.back();
+            stack.pop_back();
+            if (id < 0) {
+                for (int i = ~id; ; i++) {
+                    auto& tri = tris_[i];
+                    for (int j = 0; j < 4; j++) {
+                        if (tri.id[j] == -1) continue;
+                        if (intersect_tri(tri, j, org, dir, tmin, tmax)) {
+                            t = tmax;
+                            n = float3(tri.n[0][j], tri.n[1][j], tri.n[2][j]);
+                            found = true;
+                        }
+                    }
+                    if (tri.id[3] & 0x80000000) break;
+                }
+                continue;
+            }
+
+            auto& node = nodes_[id - 1];
+            for (int i = 0; i < 4 && node.child[i] != 0; i++) {
+                auto t0x = (node.bounds[0][i] - org.x) * inv_dir.x, t1x = (node.bounds[1][i] - org.x) * inv_dir.x;
+                auto t0y = (node.bounds[2][i] - org.y) * inv_dir.y, t1y = (node.bounds[3][i] - org.y) * inv_dir.y;
+                auto t0z = (node.bounds[4][i] - org.z) * inv_dir.z, t1z = (node.bounds[5][i] - org.z) * inv_dir.z;
+                auto entry = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), tmin));
+                auto exit  = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), tmax));
+                if (entry <= exit) stack.push_back(node.child[i]);
+            }
+        }
+        return found;
+    }
+
+private:
+    // Moeller-Trumbore test, with the vertices v0, v1 = v0 - e1, and v2 = v0 + e2
+    static bool intersect_tri(const Bvh4Tri& tri, int j, const float3& org, const float3& dir, float tmin, float& tmax) {
+        auto v0 = float3(tri.v0[0][j], tri.v0[1][j], tri.v0[2][j]);
+        auto e1 = -float3(tri.e1[0][j], tri.e1[1][j], tri.e1[2][j]);
+        auto e2 =  float3(tri.e2[0][j], tri.e2[1][j], tri.e2[2][j]);
+        auto p = cross(dir, e2);
+        auto det = dot(e1, p);
+        if (det == 0.0f) return false;
+        auto inv_det = 1.0f / det;
+        auto s = org - v0;
+        auto u = dot(s, p) * inv_det;
+        if (u < 0.0f || u > 1.0f) return false;
+        auto q = cross(s, e1);
+        auto v = dot(dir, q) * inv_det;
+        if (v < 0.0f || u + v > 1.0f) return false;
+        auto t = dot(e2, q) * inv_det;
+        if (t < tmin || t > tmax) return false;
+        tmax = t;
+        return true;
+    }
+
+    const anydsl::Array<Bvh4Node>& nodes_;
+    const anydsl::Array<Bvh4Tri>& tris_;
+};
+
+// Cosine-weighted direction around the normal, as in sample_cosine_hemisphere (the frame is the one of make_orthonormal_mat3x3)
+static float3 sample_cosine_hemisphere(const float3& n, float u, float v) {
+    auto c = std::sqrt(1.0f - v);
+    auto s = std::sqrt(v);
+    auto phi = 2.0f * float(M_PI) * u;
+
+    auto sign = n.z >= 0.0f ? 1.0f : -1.0f;
+    auto a = -1.0f / (sign + n.z);
+    auto b = n.x * n.y * a;
+    auto t  = float3(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    auto bt = float3(b, sign + n.y * n.y * a, -n.y);
+    return s * std::cos(phi) * t + s * std::sin(phi) * bt + c * n;
+}
+
 class PrimaryRayGen : public RayGen {
 public:
     PrimaryRayGen(const float3& eye,
@@ -38,17 +142,19 @@ public:
         up_    *= (float(height) / float(width)) * scale;
     }
 
-    void generate_rays(std::ofstream& os) override {
+    size_t item_count() const override { return size_t(width_) * height_; }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64&, std::vector<RayData>& rays) const override {
         auto sx = 2.0f / width_;
         auto sy = 2.0f / height_;
-        for (int i = height_ - 1; i >= 0; i--) {
-            for (int j = 0; j < width_; j++) {
-                auto kx = sx * (j + 0.5f) - 1.0f;
-                auto ky = sy * (i + 0.5f) - 1.0f ;
-                auto dir = dir_ + kx * right_ + ky * up_;
-                os.write((char*)&eye_, sizeof(float3));
-                os.write((char*)&dir, sizeof(float3));
-            }
+        // Rows are written from the top of the image
+        for (size_t k = begin; k < end; k++) {
+            int i = height_ - 1 - k / width_;
+            int j = k % width_;
+            auto kx = sx * (j + 0.5f) - 1.0f;
+            auto ky = sy * (i + 0.5f) - 1.0f ;
+            auto dir = dir_ + kx * right_ + ky * up_;
+            rays.push_back(RayData { eye_, dir });
         }
     }
 
@@ -67,14 +173,14 @@ public:
         , float_buffer_(float_buffer)
     {}
 
-    void generate_rays(std::ofstream& os) override {
-        for (int i = 0; i < rays_.size(); i++) {
+    size_t item_count() const override { return rays_.size(); }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64&, std::vector<RayData>& rays) const override {
+        for (size_t i = begin; i < end; i++) {
             auto org = float3(rays_[i].org[0], rays_[i].org[1], rays_[i].org[2]);
             auto dir = float3(rays_[i].dir[0], rays_[i].dir[1], rays_[i].dir[2]);
             auto hit = org + float_buffer_[i] * dir;
-            auto new_dir = hit - light_;
-            os.write((char*)&light_, sizeof(float3));
-            os.write((char*)&new_dir, sizeof(float3));
+            rays.push_back(RayData { light_, hit - light_ });
         }
     }
 
@@ -86,32 +192,329 @@ private:
 
 class RandomRayGen : public RayGen {
 public:
-    RandomRayGen(const BBox& bounds, size_t count, int seed)
+    RandomRayGen(const BBox& bounds, size_t count)
         : bounds_(bounds)
         , count_(count)
-        , gen_(seed)
     {}
 
-    void generate_rays(std::ofstream& os) override {
+    size_t item_count() const override { return count_; }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64& gen, std::vector<RayData>& rays) const override {
+        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        auto extents = bounds_.max - bounds_.min;
+        for (size_t i = begin; i < end; i++) {
+            auto rnd1 = bounds_.min + extents * float3(dis(gen), dis(gen), dis(gen));
+            auto rnd2 = bounds_.min + extents * float3(dis(gen), dis(gen), dis(gen));
+            rays.push_back(RayData { rnd1, rnd2 - rnd1 });
+        }
+    }
+
+private:
+    BBox bounds_;
+    size_t count_;
+};
+
+class GrazingRayGen : public RayGen {
+public:
+    GrazingRayGen(const anydsl::Array<Bvh4Tri>& tris, const BBox& bounds, size_t count)
+        : tris_(tris)
+        , bounds_(bounds)
+        , count_(count)
+    {}
+
+    size_t item_count() const override { return count_; }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64& gen, std::vector<RayData>& rays) const override {
+        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        std::uniform_int_distribution<size_t> pick(0, tris_.size() * 4 - 1);
+        auto diag = length(bounds_.max - bounds_.min);
+        for (size_t i = begin; i < end; ) {
+            auto k = pick(gen);
+            auto& tri = tris_[k / 4];
+            auto j = k % 4;
+            if (tri.id[j] == -1) continue;
+
+            auto v0 = float3(tri.v0[0][j], tri.v0[1][j], tri.v0[2][j]);
+            auto e1 = float3(tri.e1[0][j], tri.e1[1][j], tri.e1[2][j]);
+            auto e2 = float3(tri.e2[0][j], tri.e2[1][j], tri.e2[2][j]);
+            auto n = cross(e1, e2);
+            if (lensqr(n) == 0.0f) continue;
+            n = normalize(n);
+
+            // Point inside the triangle (v1 = v0 - e1, v2 = v0 + e2)
+            auto u = dis(gen), v = dis(gen);
+            if (u + v > 1.0f) { u = 1.0f - u; v = 1.0f - v; }
+            auto target = v0 - u * e1 + v * e2;
+
+            // Direction almost parallel to the triangle plane
+            auto t = float3(dis(gen), dis(gen), dis(gen)) - float3(0.5f);
+            t = t - dot(t, n) * n;
+            if (lensqr(t) == 0.0f) continue;
+            auto slope = (dis(gen) - 0.5f) * 2e-3f;
+            auto dir = normalize(normalize(t) + slope * n);
+
+            auto org = target - (0.01f + dis(gen)) * diag * dir;
+            rays.push_back(RayData { org, dir });
+            i++;
+        }
+    }
+
+private:
+    const anydsl::Array<Bvh4Tri>& tris_;
+    BBox bounds_;
+    size_t count_;
+};
+
+class PointRayGen : public RayGen {
+public:
+    PointRayGen(const float3& org, size_t count)
+        : org_(org)
+        , count_(count)
+    {}
+
+    size_t item_count() const override { return count_; }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64& gen, std::vector<RayData>& rays) const override {
+        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        for (size_t i = begin; i < end; i++) {
+            // Uniform direction on the unit sphere
+            auto z = 1.0f - 2.0f * dis(gen);
+            auto r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            auto phi = 2.0f * float(M_PI) * dis(gen);
+            auto dir = float3(r * std::cos(phi), r * std::sin(phi), z);
+            rays.push_back(RayData { org_, dir });
+        }
+    }
+
+private:
+    float3 org_;
+    size_t count_;
+};
+
+// Hit points of a set of rays, found from the distances computed by the traversal
+struct SurfacePoint {
+    float3 pos;
+    float3 n;       ///< Normal, facing the incoming ray
+
+    /// Origin of the rays leaving the surface, moved along the normal so that they do not hit it again at t = 0
+    float3 ray_org(float offset) const { return pos + offset * n; }
+};
+
+static void find_surface_points(const BvhTracer& tracer,
+                                const anydsl::Array<Ray1AoS>& rays,
+                                const std::vector<float>& float_buffer,
+                                std::vector<SurfacePoint>& points) {
+    // Points are found in parallel, and compacted in the order of the rays
+    std::vector<SurfacePoint> all_points(rays.size());
+    std::vector<uint8_t> valid(rays.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, rays.size()), [&] (const tbb::blocked_range<size_t>& range) {
+        for (auto i = range.begin(); i != range.end(); i++) {
+            auto org = float3(rays[i].org[0], rays[i].org[1], rays[i].org[2]);
+            auto dir = float3(rays[i].dir[0], rays[i].dir[1], rays[i].dir[2]);
+            auto t = float_buffer[i];
+
+            // Only look for the triangle around the distance found by the traversal (misses are skipped)
+            float3 n;
+            valid[i] = tracer.intersect(org, dir, t * (1.0f - 1e-3f), t * (1.0f + 1e-3f), t, n) && lensqr(n) > 0.0f;
+            if (!valid[i]) continue;
+            n = normalize(n);
+            if (dot(n, dir) > 0.0f) n = -n;
+            all_points[i] = SurfacePoint { org + t * dir, n };
+        }
+    });
+    for (int64_t i = 0; i < rays.size(); i++) {
+        if (valid[i]) points.push_back(all_points[i]);
+    }
+}
+
+class AoRayGen : public RayGen {
+public:
+    AoRayGen(const std::vector<SurfacePoint>& points, int samples, float offset, float dist)
+        : points_(points)
+        , samples_(samples)
+        , offset_(offset)
+        , dist_(dist)
+    {}
+
+    size_t item_count() const override { return points_.size(); }
+
+    bool extents(float& tmin, float& tmax) const override {
+        tmin = 0.0f;
+        tmax = dist_;
+        return true;
+    }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64& gen, std::vector<RayData>& rays) const override {
+        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        for (size_t i = begin; i < end; i++) {
+            auto& point = points_[i];
+            for (int j = 0; j < samples_; j++) {
+                auto u = dis(gen), v = dis(gen);
+                rays.push_back(RayData { point.ray_org(offset_), sample_cosine_hemisphere(point.n, u, v) });
+            }
+        }
+    }
+
+private:
+    const std::vector<SurfacePoint>& points_;
+    int samples_;
+    float offset_;
+    float dist_;
+};
+
+class BounceRayGen : public RayGen {
+public:
+    BounceRayGen(const BvhTracer& tracer, const std::vector<SurfacePoint>& points, int depth, float offset)
+        : tracer_(tracer)
+        , points_(points)
+        , depth_(depth)
+        , offset_(offset)
+    {}
+
+    size_t item_count() const override { return points_.size(); }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64& gen, std::vector<RayData>& rays) const override {
+        // Paths are traced on diffuse surfaces, and only the rays of the last bounce are written
+        std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        for (size_t i = begin; i < end; i++) {
+            auto point = points_[i];
+            bool alive = true;
+            for (int d = 1; d < depth_ && alive; d++) {
+                auto dir = sample_cosine_hemisphere(point.n, dis(gen), dis(gen));
+                float t;
+                float3 n;
+                auto org = point.ray_org(offset_);
+                alive = tracer_.intersect(org, dir, 0.0f, FLT_MAX, t, n) && lensqr(n) > 0.0f;
+                if (alive) {
+                    n = normalize(n);
+                    point = SurfacePoint { org + t * dir, dot(n, dir) > 0.0f ? -n : n };
+                }
+            }
+            if (!alive) continue;
+
+            auto u = dis(gen), v = dis(gen);
+            rays.push_back(RayData { point.ray_org(offset_), sample_cosine_hemisphere(point.n, u, v) });
+        }
+    }
+
+private:
+    const BvhTracer& tracer_;
+    const std::vector<SurfacePoint>& points_;
+    int depth_;
+    float offset_;
+};
+
+class BundleRayGen : public RayGen {
+public:
+    BundleRayGen(const anydsl::Array<Bvh4Tri>& tris, const BBox& bounds, size_t count, int size, float angle)
+        : tris_(tris)
+        , bounds_(bounds)
+        , count_(count)
+        , size_(size)
+        , cos_max_(std::cos(angle * float(M_PI) / 180.0f))
+    {}
+
+    size_t item_count() const override { return count_; }
+
+    void generate_rays(size_t begin, size_t end, std::mt19937_64& gen, std::vector<RayData>& rays) const override {
         std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+        std::uniform_int_distribution<size_t> pick(0, tris_.size() * 4 - 1);
         auto extents = bounds_.max - bounds_.min;
-        for (int i = 0; i < count_; i++) {
-            auto rnd1 = bounds_.min + extents * float3(dis(gen_), dis(gen_), dis(gen_));
-            auto rnd2 = bounds_.min + extents * float3(dis(gen_), dis(gen_), dis(gen_));
-            auto dir = rnd2 - rnd1;
-            os.write((char*)&rnd1, sizeof(float3));
-            os.write((char*)&dir, sizeof(float3));
+        for (size_t i = begin; i < end; ) {
+            // The axis of the bundle goes from a random point in the scene to a random point on a triangle
+            auto k = pick(gen);
+            auto& tri = tris_[k / 4];
+            auto j = k % 4;
+            if (tri.id[j] == -1) continue;
+
+            auto v0 = float3(tri.v0[0][j], tri.v0[1][j], tri.v0[2][j]);
+            auto e1 = float3(tri.e1[0][j], tri.e1[1][j], tri.e1[2][j]);
+            auto e2 = float3(tri.e2[0][j], tri.e2[1][j], tri.e2[2][j]);
+            auto u = dis(gen), v = dis(gen);
+            if (u + v > 1.0f) { u = 1.0f - u; v = 1.0f - v; }
+            auto target = v0 - u * e1 + v * e2;
+            auto org = bounds_.min + extents * float3(dis(gen), dis(gen), dis(gen));
+            if (lensqr(target - org) == 0.0f) continue;
+            auto axis = normalize(target - org);
+
+            // Rays of the bundle are distributed uniformly in a cone around the axis
+            for (int r = 0; r < size_; r++) {
+                auto c = 1.0f - dis(gen) * (1.0f - cos_max_);
+                rays.push_back(RayData { org, sample_cone(axis, c, dis(gen)) });
+            }
+            i++;
         }
     }
 
 private:
+    static float3 sample_cone(const float3& axis, float c, float u) {
+        auto s = std::sqrt(std::max(0.0f, 1.0f - c * c));
+        auto phi = 2.0f * float(M_PI) * u;
+        auto t = normalize(cross(axis, std::fabs(axis.x) > 0.5f ? float3(0, 1, 0) : float3(1, 0, 0)));
+        auto b = cross(axis, t);
+        return s * std::cos(phi) * t + s * std::sin(phi) * b + c * axis;
+    }
+
+    const anydsl::Array<Bvh4Tri>& tris_;
     BBox bounds_;
     size_t count_;
-    std::mt19937_64 gen_;
+    int size_;
+    float cos_max_;
 };
 
+// Generates the rays by chunks of items, in parallel, and writes the chunks in order.
+// Every chunk has its own random generator, seeded from its index, so that the output
+// only depends on the seed, and not on the number of threads.
+// Rays are written in packets of the given width, or in the legacy format if the width is 0.
+static bool write_rays(const RayGen& ray_gen, int seed, uint32_t width, std::ofstream& os) {
+    static constexpr size_t chunk_size = 1 << 16;
+    static constexpr size_t chunks_per_batch = 256;
+
+    auto item_count = ray_gen.item_count();
+    auto chunk_count = (item_count + chunk_size - 1) / chunk_size;
+    std::vector<std::vector<RayData>> chunks(std::min(chunk_count, chunks_per_batch));
+    float tmin = 0.0f, tmax = 0.0f;
+    auto has_extents = ray_gen.extents(tmin, tmax);
+    std::unique_ptr<RayFileWriter> writer;
+    if (width != 0)
+        writer.reset(new RayFileWriter(os, width, has_extents ? uint32_t(RayFileHeader::HAS_EXTENTS) : 0));
+    else if (has_extents)
+        std::cerr << "Legacy files cannot store the extents of the rays (trace them with -tmin " << tmin << " -tmax " << tmax << ")" << std::endl;
+    size_t ray_count = 0;
+    for (size_t first = 0; first < chunk_count; first += chunks_per_batch) {
+        auto last = std::min(first + chunks_per_batch, chunk_count);
+        tbb::parallel_for(first, last, [&] (size_t chunk) {
+            std::seed_seq seq { uint32_t(seed), uint32_t(chunk), uint32_t(chunk >> 32) };
+            std::mt19937_64 gen(seq);
+            auto& rays = chunks[chunk - first];
+            rays.clear();
+            ray_gen.generate_rays(chunk * chunk_size, std::min((chunk + 1) * chunk_size, item_count), gen, rays);
+        });
+        // Chunks are written in order (with one large write per chunk in the legacy format)
+        for (size_t chunk = first; chunk < last; chunk++) {
+            auto& rays = chunks[chunk - first];
+            if (writer) {
+                for (auto& ray : rays)
+                    writer->add_ray((const float*)&ray, tmin, tmax);
+            } else {
+                os.write((const char*)rays.data(), rays.size() * sizeof(RayData));
+            }
+            if (!os) return false;
+            ray_count += rays.size();
+        }
+    }
+    if (writer && !writer->close()) return false;
+    std::cout << ray_count << " ray(s) generated" << std::endl;
+    return true;
+}
+
 inline void usage() {
-    std::cout << "Usage: ray_gen mode arguments output\n"
+    std::cout << "Usage: ray_gen [options] mode arguments output\n"
+                 "Available options:\n"
+                 "  -width                       Number of rays per packet in the output file (1, 4, 8, or 16, default: 8)\n"
+                 "  -legacy                      Writes a headerless file, with 6 floats per ray\n"
+                 "  -ao-dist                     Maximum distance of ambient occlusion rays, relative to the scene diagonal (default: 0.1)\n"
+                 "\n"
                  "Available modes:\n"
                  "  primary                      Generates primary rays from a pinhole camera\n"
                  "    eye-x  eye-y eye-z         Camera position\n"
@@ -128,12 +531,46 @@ inline void usage() {
                  "  random                     Generates random rays within a scene\n"
                  "    bvh-file                   BVH file from which the scene bounds will be extracted\n"
                  "    ray-count                  Number of rays to generate\n"
+                 "    seed                       Random generator seed\n"
+                 "\n"
+                 "  grazing                    Generates rays that hit triangles at grazing angles\n"
+                 "                             (every ray hits the scene, so every miss is a false miss)\n"
+                 "    bvh-file                   BVH file from which the triangles will be extracted\n"
+                 "    ray-count                  Number of rays to generate\n"
+                 "    seed                       Random generator seed\n"
+                 "\n"
+                 "  point                      Generates rays in random directions from a point\n"
+                 "                             (from inside a closed mesh, every ray that misses is a leak)\n"
+                 "    org-x org-y org-z          Origin of the rays\n"
+                 "    ray-count                  Number of rays to generate\n"
+                 "    seed                       Random generator seed\n"
+                 "\n"
+                 "  ao                         Generates cosine-weighted ambient occlusion rays at the hit points of a ray file\n"
+                 "    bvh-file                   BVH file of the scene\n"
+                 "    ray-file                   Primary ray file\n"
+                 "    fbuf-file                  Result of traversal for the ray file\n"
+                 "    samples                    Number of rays per hit point\n"
+                 "    seed                       Random generator seed\n"
+                 "                             (the rays start slightly above the surface, and their maximum\n"
+                 "                             distance is set with -ao-dist, written as ray extents)\n"
+                 "\n"
+                 "  bounce                     Generates diffuse bounce rays by tracing paths from the hit points of a ray file\n"
+                 "    bvh-file                   BVH file of the scene\n"
+                 "    ray-file                   Primary ray file\n"
+                 "    fbuf-file                  Result of traversal for the ray file\n"
+                 "    depth                      Bounce to generate (1 for the first bounce after the primary hit)\n"
+                 "    seed                       Random generator seed\n"
+                 "                             (the rays start slightly above the surface)\n"
+                 "\n"
+                 "  bundle                     Generates bundles of rays that share an origin, in cones pointing to the scene\n"
+                 "    bvh-file                   BVH file from which the triangles will be extracted\n"
+                 "    bundle-count               Number of bundles to generate\n"
+                 "    bundle-size                Number of rays per bundle\n"
+                 "    angle                      Half-angle of the cones in degrees (0: identical rays, 180: random directions)\n"
                  "    seed                       Random generator seed\n";
 }
 
-static bool extract_bounds(const std::string& bvh_file, BBox& bounds) {
-    anydsl::Array<Bvh4Node> nodes;
-    anydsl::Array<Bvh4Tri>  tris;
+static bool extract_bounds(const std::string& bvh_file, BBox& bounds, anydsl::Array<Bvh4Node>& nodes, anydsl::Array<Bvh4Tri>& tris) {
     if (!load_bvh(bvh_file, nodes, tris, BvhType::BVH4, false)) return false;
     bounds = BBox::empty();
     for (int i = 0; i < 4; i++) {
@@ -143,7 +580,42 @@ static bool extract_bounds(const std::string& bvh_file, BBox& bounds) {
     return true;
 }
 
+static bool load_fbuf(const std::string& fbuf_file, size_t count, std::vector<float>& float_buffer) {
+    std::ifstream fbuf(fbuf_file, std::ifstream::binary);
+    float_buffer.resize(count);
+    return (bool)fbuf.read((char*)float_buffer.data(), count * sizeof(float));
+}
+
 int main(int argc, char** argv) {
+    uint32_t width = 8;
+    float ao_dist = 0.1f;
+    while (argc >= 2 && argv[1][0] == '-' && strcmp(argv[1], "-h") && strcmp(argv[1], "--help")) {
+        if (!strcmp(argv[1], "-width") && argc >= 3) {
+            width = strtoul(argv[2], nullptr, 10);
+            if (width != 1 && width != 4 && width != 8 && width != 16) {
+                std::cerr << "Invalid packet width" << std::endl;
+                return 1;
+            }
+            argv += 2;
+            argc -= 2;
+        } else if (!strcmp(argv[1], "-ao-dist") && argc >= 3) {
+            ao_dist = strtof(argv[2], nullptr);
+            if (ao_dist <= 0.0f) {
+                std::cerr << "Invalid ambient occlusion distance" << std::endl;
+                return 1;
+            }
+            argv += 2;
+            argc -= 2;
+        } else if (!strcmp(argv[1], "-legacy")) {
+            width = 0;
+            argv++;
+            argc--;
+        } else {
+            std::cerr << "Unknown option '" << argv[1] << "'" << std::endl;
+            return 1;
+        }
+    }
+
     if (argc < 2) {
         std::cerr << "Not enough arguments" << std::endl;
         return 1;
@@ -151,6 +623,14 @@ int main(int argc, char** argv) {
 
     std::unique_ptr<RayGen> ray_gen;
     std::string output;
+    int seed = 0;
+    BBox bounds;
+    anydsl::Array<Bvh4Node> nodes;
+    anydsl::Array<Bvh4Tri> tris;
+    anydsl::Array<Ray1AoS> rays;
+    std::vector<float> float_buffer;
+    std::vector<SurfacePoint> points;
+    std::unique_ptr<BvhTracer> tracer;
     if (!strcmp(argv[1], "primary")) {
         if (argc != 15) {
             std::cerr << "Incorrect number of arguments in primary mode" << std::endl;
@@ -179,15 +659,12 @@ int main(int argc, char** argv) {
         auto height = strtol(argv[8], nullptr, 10);
         output = argv[9];
 
-        anydsl::Array<Ray1AoS> rays;
         if (!load_rays(ray_file, rays, 0.0f, 1.0f, false)) {
             std::cerr << "Cannot load rays" << std::endl;
             return 1;
         }
         
-        std::ifstream fbuf(fbuf_file, std::ifstream::binary);
-        std::vector<float> float_buffer(rays.size());
-        if (!fbuf.read((char*)float_buffer.data(), rays.size() * sizeof(float))) {
+        if (!load_fbuf(fbuf_file, rays.size(), float_buffer)) {
             std::cerr << "Cannot load result of traversal" << std::endl;
             return 1;
         }
@@ -201,16 +678,109 @@ int main(int argc, char** argv) {
 
         std::string bvh_file  = argv[2];
         auto ray_count  = strtol(argv[3], nullptr, 10);
-        auto seed = strtol(argv[4], nullptr, 10);
+        seed = strtol(argv[4], nullptr, 10);
         output = argv[5];
 
-        BBox bounds;
-        if (!extract_bounds(bvh_file, bounds)) {
+        if (!extract_bounds(bvh_file, bounds, nodes, tris)) {
             std::cerr << "Cannot extract scene bounds" << std::endl;
             return 1;
         }
 
-        ray_gen.reset(new RandomRayGen(bounds, ray_count, seed));
+        ray_gen.reset(new RandomRayGen(bounds, ray_count));
+    } else if (!strcmp(argv[1], "grazing")) {
+        if (argc != 6) {
+            std::cerr << "Incorrect number of arguments in grazing mode" << std::endl;
+            return 1;
+        }
+
+        std::string bvh_file  = argv[2];
+        auto ray_count  = strtol(argv[3], nullptr, 10);
+        seed = strtol(argv[4], nullptr, 10);
+        output = argv[5];
+
+        if (!extract_bounds(bvh_file, bounds, nodes, tris)) {
+            std::cerr << "Cannot extract scene triangles" << std::endl;
+            return 1;
+        }
+
+        ray_gen.reset(new GrazingRayGen(tris, bounds, ray_count));
+    } else if (!strcmp(argv[1], "point")) {
+        if (argc != 8) {
+            std::cerr << "Incorrect number of arguments in point mode" << std::endl;
+            return 1;
+        }
+
+        auto org = float3(strtof(argv[2], nullptr), strtof(argv[3], nullptr), strtof(argv[4], nullptr));
+        auto ray_count = strtol(argv[5], nullptr, 10);
+        seed = strtol(argv[6], nullptr, 10);
+        output = argv[7];
+
+        ray_gen.reset(new PointRayGen(org, ray_count));
+    } else if (!strcmp(argv[1], "ao") || !strcmp(argv[1], "bounce")) {
+        bool ao = !strcmp(argv[1], "ao");
+        if (argc != 8) {
+            std::cerr << "Incorrect number of arguments in " << argv[1] << " mode" << std::endl;
+            return 1;
+        }
+
+        std::string bvh_file  = argv[2];
+        std::string ray_file  = argv[3];
+        std::string fbuf_file = argv[4];
+        auto param = strtol(argv[5], nullptr, 10);
+        seed = strtol(argv[6], nullptr, 10);
+        output = argv[7];
+
+        if (param < 1) {
+            std::cerr << (ao ? "Invalid number of samples" : "Invalid bounce depth") << std::endl;
+            return 1;
+        }
+        if (!extract_bounds(bvh_file, bounds, nodes, tris)) {
+            std::cerr << "Cannot load BVH file" << std::endl;
+            return 1;
+        }
+        if (!load_rays(ray_file, rays, 0.0f, 1.0f, false)) {
+            std::cerr << "Cannot load rays" << std::endl;
+            return 1;
+        }
+        if (!load_fbuf(fbuf_file, rays.size(), float_buffer)) {
+            std::cerr << "Cannot load result of traversal" << std::endl;
+            return 1;
+        }
+
+        tracer.reset(new BvhTracer(nodes, tris));
+        find_surface_points(*tracer, rays, float_buffer, points);
+        std::cout << points.size() << " hit point(s) found" << std::endl;
+
+        // Offset of the ray origins, to avoid self-intersections
+        auto diag = length(bounds.max - bounds.min);
+        auto offset = 1e-5f * diag;
+        if (ao)
+            ray_gen.reset(new AoRayGen(points, param, offset, ao_dist * diag));
+        else
+            ray_gen.reset(new BounceRayGen(*tracer, points, param, offset));
+    } else if (!strcmp(argv[1], "bundle")) {
+        if (argc != 8) {
+            std::cerr << "Incorrect number of arguments in bundle mode" << std::endl;
+            return 1;
+        }
+
+        std::string bvh_file = argv[2];
+        auto bundle_count = strtol(argv[3], nullptr, 10);
+        auto bundle_size  = strtol(argv[4], nullptr, 10);
+        auto angle = strtof(argv[5], nullptr);
+        seed = strtol(argv[6], nullptr, 10);
+        output = argv[7];
+
+        if (bundle_size < 1 || angle < 0.0f || angle > 180.0f) {
+            std::cerr << "Invalid bundle size or angle" << std::endl;
+            return 1;
+        }
+        if (!extract_bounds(bvh_file, bounds, nodes, tris)) {
+            std::cerr << "Cannot extract scene triangles" << std::endl;
+            return 1;
+        }
+
+        ray_gen.reset(new BundleRayGen(tris, bounds, bundle_count, bundle_size, angle));
     } else if (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
         usage();
         return 0;
@@ -220,7 +790,10 @@ int main(int argc, char** argv) {
     }
 
     std::ofstream os(output, std::ofstream::binary);
-    ray_gen->generate_rays(os);
+    if (!os || !write_rays(*ray_gen, seed, width, os)) {
+        std::cerr << "Cannot write output file" << std::endl;
+        return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,437 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <cstring>
+
+#include "float3.h"
+#include "bbox.h"
+#include "tri.h"
+
+#ifdef ENABLE_BVH_OUTPUT
+#include "build_bvh.h"
+#endif
+
+// Random numbers that do not depend on the implementation of the standard library,
+// so that a given seed generates the same scene on every machine
+class Rng {
+public:
+    Rng(int seed) : gen_(seed) {}
+
+    /// Returns a random number in [0, 1).
+    float next() { return (gen_() >> 40) * (1.0f / 16777216.0f); }
+    float3 next3() { auto x = next(); auto y = next(); return float3(x, y, next()); }
+
+    /// Returns a random unit vector.
+    float3 direction() {
+        auto z = 1.0f - 2.0f * next();
+        auto r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+        auto phi = 2.0f * float(M_PI) * next();
+        return float3(r * std::cos(phi), r * std::sin(phi), z);
+    }
+
+private:
+    std::mt19937_64 gen_;
+};
+
+class MeshWriter {
+public:
+    virtual ~MeshWriter() {}
+    /// Adds a vertex and returns its index.
+    virtual size_t add_vertex(const float3&) = 0;
+    virtual void add_triangle(size_t, size_t, size_t) = 0;
+    /// Starts a new object (e.g. a sphere, or a triangle of a soup), which may get its own material.
+    virtual void begin_object() {}
+
+    void add_triangle(const float3& v0, const float3& v1, const float3& v2) {
+        auto i0 = add_vertex(v0);
+        auto i1 = add_vertex(v1);
+        auto i2 = add_vertex(v2);
+        add_triangle(i0, i1, i2);
+    }
+};
+
+// Streams the mesh to the file, so that very large scenes do not have to fit in memory.
+// When there are materials, each object gets one of them at random.
+class ObjWriter : public MeshWriter {
+public:
+    ObjWriter(std::ofstream& os, const std::string& mtl_lib, size_t materials, int seed)
+        : os_(os), vertex_count_(0), tri_count_(0), materials_(materials), material_(materials), rng_(seed)
+    {
+        os_ << std::setprecision(9);
+        os_ << "# Generated by scene_gen\n";
+        if (materials_ > 0)
+            os_ << "mtllib " << mtl_lib << "\n";
+        os_ << "o scene\n";
+    }
+
+    void begin_object() override {
+        if (materials_ == 0) return;
+        auto material = std::min(materials_ - 1, size_t(rng_.next() * materials_));
+        if (material != material_)
+            os_ << "usemtl m" << material << "\n";
+        material_ = material;
+    }
+
+    size_t add_vertex(const float3& v) override {
+        os_ << "v " << v.x << " " << v.y << " " << v.z << "\n";
+        return vertex_count_++;
+    }
+
+    void add_triangle(size_t i0, size_t i1, size_t i2) override {
+        os_ << "f " << i0 + 1 << " " << i1 + 1 << " " << i2 + 1 << "\n";
+        tri_count_++;
+    }
+
+    size_t tri_count() const { return tri_count_; }
+
+private:
+    std::ofstream& os_;
+    size_t vertex_count_;
+    size_t tri_count_;
+    size_t materials_;
+    size_t material_;
+    Rng rng_;
+};
+
+// Writes the materials m0, m1, ... to an MTL file. One material in 16 is emissive (the first one included),
+// and the others cycle through the diffuse, glossy, mirror and glass kinds, with random colors.
+static void write_mtl(std::ofstream& os, size_t count, int seed) {
+    Rng rng(seed);
+    os << std::setprecision(9);
+    os << "# Generated by scene_gen\n";
+    for (size_t i = 0; i < count; i++) {
+        auto color = 0.2f * float3(1.0f) + 0.8f * rng.next3();
+        os << "\nnewmtl m" << i << "\n";
+        if (i % 16 == 0) {
+            os << "Ke " << 4.0f * color.x << " " << 4.0f * color.y << " " << 4.0f * color.z << "\n";
+            continue;
+        }
+        switch (i % 4) {
+            case 0: os << "Kd " << color.x << " " << color.y << " " << color.z << "\n"; break;
+            case 1:
+                os << "Kd " << 0.1f * color.x << " " << 0.1f * color.y << " " << 0.1f * color.z << "\n";
+                os << "Ks " << color.x << " " << color.y << " " << color.z << "\n";
+                os << "Ns " << 10.0f + 990.0f * rng.next() << "\n";
+                break;
+            case 2: os << "Ks " << color.x << " " << color.y << " " << color.z << "\nillum 3\n"; break;
+            case 3: os << "Tf " << color.x << " " << color.y << " " << color.z << "\nNi 1.5\nillum 7\n"; break;
+        }
+    }
+}
+
+class TriWriter : public MeshWriter {
+public:
+    TriWriter(std::vector<Tri>& tris)
+        : tris_(tris)
+    {}
+
+    size_t add_vertex(const float3& v) override {
+        vertices_.push_back(v);
+        return vertices_.size() - 1;
+    }
+
+    void add_triangle(size_t i0, size_t i1, size_t i2) override {
+        tris_.emplace_back(vertices_[i0], vertices_[i1], vertices_[i2]);
+    }
+
+private:
+    std::vector<float3> vertices_;
+    std::vector<Tri>& tris_;
+};
+
+class SceneGen {
+public:
+    virtual ~SceneGen() {}
+    virtual void generate_scene(MeshWriter&) = 0;
+};
+
+// Random triangles in the unit cube, sized so that the scene has a moderate depth complexity
+class SoupSceneGen : public SceneGen {
+public:
+    SoupSceneGen(size_t count, int seed)
+        : count_(count), rng_(seed)
+    {}
+
+    void generate_scene(MeshWriter& writer) override {
+        auto size = 2.0f / std::cbrt(float(count_));
+        for (size_t i = 0; i < count_; i++) {
+            writer.begin_object();
+            auto center = rng_.next3();
+            auto v0 = center + size * (rng_.next3() - float3(0.5f));
+            auto v1 = center + size * (rng_.next3() - float3(0.5f));
+            auto v2 = center + size * (rng_.next3() - float3(0.5f));
+            writer.add_triangle(v0, v1, v2);
+        }
+    }
+
+private:
+    size_t count_;
+    Rng rng_;
+};
+
+// Randomly rotated copies of a tessellated sphere, placed on a regular 3D grid
+class InstanceSceneGen : public SceneGen {
+public:
+    InstanceSceneGen(size_t count, int seed)
+        : count_(count), rng_(seed)
+    {}
+
+    void generate_scene(MeshWriter& writer) override {
+        // The sphere has 4 * rings * (rings - 1) triangles, which keeps the grid dense at every scale
+        int rings = std::max(4, std::min(64, int(std::sqrt(count_ / 1024.0f))));
+        auto tris_per_instance = 4 * rings * (rings - 1);
+        auto instances = std::max(size_t(1), count_ / tris_per_instance);
+        int side = std::ceil(std::cbrt(double(instances)));
+        auto radius = 0.4f / side;
+
+        size_t done = 0;
+        for (int z = 0; z < side && done < instances; z++) {
+            for (int y = 0; y < side && done < instances; y++) {
+                for (int x = 0; x < side && done < instances; x++, done++) {
+                    auto center = (float3(x, y, z) + float3(0.5f)) * (1.0f / side);
+                    // Random orthonormal frame
+                    auto n = rng_.direction();
+                    auto t = normalize(cross(n, std::fabs(n.x) > 0.5f ? float3(0, 1, 0) : float3(1, 0, 0)));
+                    auto b = cross(n, t);
+                    writer.begin_object();
+                    add_sphere(writer, center, radius, t, b, n, rings);
+                }
+            }
+        }
+    }
+
+private:
+    static void add_sphere(MeshWriter& writer, const float3& center, float radius,
+                           const float3& t, const float3& b, const float3& n, int rings) {
+        auto segments = 2 * rings;
+        auto top    = writer.add_vertex(center + radius * n);
+        auto bottom = writer.add_vertex(center - radius * n);
+        size_t first = 0;
+        for (int i = 1; i < rings; i++) {
+            auto theta = float(M_PI) * i / rings;
+            for (int j = 0; j < segments; j++) {
+                auto phi = 2.0f * float(M_PI) * j / segments;
+                auto dir = std::sin(theta) * (std::cos(phi) * t + std::sin(phi) * b) + std::cos(theta) * n;
+                auto index = writer.add_vertex(center + radius * dir);
+                if (i == 1 && j == 0) first = index;
+            }
+        }
+        auto vertex = [&] (int i, int j) { return first + (i - 1) * segments + (j % segments); };
+        for (int j = 0; j < segments; j++) {
+            writer.add_triangle(top, vertex(1, j), vertex(1, j + 1));
+            writer.add_triangle(bottom, vertex(rings - 1, j + 1), vertex(rings - 1, j));
+        }
+        for (int i = 1; i < rings - 1; i++) {
+            for (int j = 0; j < segments; j++) {
+                writer.add_triangle(vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1));
+                writer.add_triangle(vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1));
+            }
+        }
+    }
+
+    size_t count_;
+    Rng rng_;
+};
+
+// Tessellated height field made of random waves, with shared vertices
+class SurfaceSceneGen : public SceneGen {
+public:
+    SurfaceSceneGen(size_t count, int seed)
+        : count_(count), rng_(seed)
+    {}
+
+    void generate_scene(MeshWriter& writer) override {
+        static constexpr int num_waves = 8;
+        float3 waves[num_waves];
+        float phases[num_waves];
+        for (int i = 0; i < num_waves; i++) {
+            auto freq = 2.0f * float(M_PI) * (1 + i * 2);
+            auto angle = 2.0f * float(M_PI) * rng_.next();
+            waves[i] = float3(freq * std::cos(angle), freq * std::sin(angle), 0.1f / (1 + i));
+            phases[i] = 2.0f * float(M_PI) * rng_.next();
+        }
+
+        int res = std::max(1, int(std::sqrt(count_ / 2.0)));
+        size_t first = 0;
+        for (int i = 0; i <= res; i++) {
+            for (int j = 0; j <= res; j++) {
+                auto x = float(j) / res, y = float(i) / res;
+                auto h = 0.5f;
+                for (int k = 0; k < num_waves; k++)
+                    h += waves[k].z * std::sin(waves[k].x * x + waves[k].y * y + phases[k]);
+                auto index = writer.add_vertex(float3(x, h, y));
+                if (i == 0 && j == 0) first = index;
+            }
+        }
+        auto vertex = [&] (int i, int j) { return first + size_t(i) * (res + 1) + j; };
+        for (int i = 0; i < res; i++) {
+            for (int j = 0; j < res; j++) {
+                writer.begin_object();
+                writer.add_triangle(vertex(i, j), vertex(i + 1, j), vertex(i + 1, j + 1));
+                writer.add_triangle(vertex(i, j), vertex(i + 1, j + 1), vertex(i, j + 1));
+            }
+        }
+    }
+
+private:
+    size_t count_;
+    Rng rng_;
+};
+
+// Long and thin triangles in random directions (e.g. hair or grass), which have very large bounding boxes
+class ThinSceneGen : public SceneGen {
+public:
+    ThinSceneGen(size_t count, int seed)
+        : count_(count), rng_(seed)
+    {}
+
+    void generate_scene(MeshWriter& writer) override {
+        auto width = 1e-3f / std::cbrt(float(count_));
+        for (size_t i = 0; i < count_; i++) {
+            writer.begin_object();
+            auto center = rng_.next3();
+            auto dir = rng_.direction();
+            auto len = 0.1f + 0.4f * rng_.next();
+            auto side = normalize(cross(dir, rng_.direction()));
+            auto v0 = center - 0.5f * len * dir;
+            auto v1 = center + 0.5f * len * dir;
+            writer.add_triangle(v0 - width * side, v0 + width * side, v1);
+        }
+    }
+
+private:
+    size_t count_;
+    Rng rng_;
+};
+
+inline void usage() {
+    std::cout << "Usage: scene_gen mode triangle-count seed output [material-count]\n"
+                 "Available modes:\n"
+                 "  soup                       Generates random triangles in the unit cube\n"
+                 "  instances                  Generates randomly rotated spheres on a regular grid\n"
+                 "  surface                    Generates a tessellated height field\n"
+                 "  thin                       Generates long and thin triangles in random directions\n"
+                 "\n"
+                 "The triangle count is approximate for the instances and surface modes.\n"
+                 "The output is an OBJ file, or a BVH file if its extension is '.bvh' (requires Embree).\n"
+                 "With a material count, every object of the OBJ file (triangle, sphere, or cell of the height field)\n"
+                 "gets one of that many random materials, which are written to an MTL file next to it.\n";
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && (!strcmp(argv[1], "-h") || !strcmp(argv[1], "--help"))) {
+        usage();
+        return 0;
+    }
+    if (argc != 5 && argc != 6) {
+        std::cerr << "Incorrect number of arguments" << std::endl;
+        return 1;
+    }
+
+    auto count = strtoull(argv[2], nullptr, 10);
+    auto seed = strtol(argv[3], nullptr, 10);
+    std::string output = argv[4];
+    auto materials = argc > 5 ? strtoull(argv[5], nullptr, 10) : 0;
+    if (count == 0) {
+        std::cerr << "Invalid triangle count" << std::endl;
+        return 1;
+    }
+
+    std::unique_ptr<SceneGen> scene_gen;
+    if (!strcmp(argv[1], "soup")) {
+        scene_gen.reset(new SoupSceneGen(count, seed));
+    } else if (!strcmp(argv[1], "instances")) {
+        scene_gen.reset(new InstanceSceneGen(count, seed));
+    } else if (!strcmp(argv[1], "surface")) {
+        scene_gen.reset(new SurfaceSceneGen(count, seed));
+    } else if (!strcmp(argv[1], "thin")) {
+        scene_gen.reset(new ThinSceneGen(count, seed));
+    } else {
+        std::cerr << "Unknown mode" << std::endl;
+        return 1;
+    }
+
+    bool bvh_output = output.size() > 4 && output.compare(output.size() - 4, 4, ".bvh") == 0;
+#ifndef ENABLE_BVH_OUTPUT
+    if (bvh_output) {
+        std::cerr << "BVH output requires Embree" << std::endl;
+        return 1;
+    }
+#endif
+    if (bvh_output && materials > 0) {
+        std::cerr << "Materials require an OBJ output" << std::endl;
+        return 1;
+    }
+
+    std::ofstream out(output, std::ofstream::binary);
+    if (!out) {
+        std::cerr << "Cannot create output file" << std::endl;
+        return 1;
+    }
+
+    if (!bvh_output) {
+        // The MTL file has the name of the OBJ file, and is referenced relative to it
+        auto slash = output.find_last_of("/\\");
+        auto dot = output.rfind('.');
+        auto stem = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? output.substr(0, dot) : output;
+        auto mtl_file = stem + ".mtl";
+        auto mtl_lib = mtl_file.substr(slash == std::string::npos ? 0 : slash + 1);
+        if (materials > 0) {
+            std::ofstream mtl_out(mtl_file);
+            if (!mtl_out) {
+                std::cerr << "Cannot create material file" << std::endl;
+                return 1;
+            }
+            write_mtl(mtl_out, materials, seed);
+        }
+
+        ObjWriter writer(out, mtl_lib, materials, seed);
+        scene_gen->generate_scene(writer);
+        std::cout << "Generated OBJ file with " << writer.tri_count() << " triangle(s)";
+        if (materials > 0)
+            std::cout << " and " << materials << " material(s) in '" << mtl_file << "'";
+        std::cout << std::endl;
+        return 0;
+    }
+
+#ifdef ENABLE_BVH_OUTPUT
+    std::vector<Tri> tris;
+    {
+        TriWriter writer(tris);
+        scene_gen->generate_scene(writer);
+    }
+    std::cout << "Generated " << tris.size() << " triangle(s)" << std::endl;
+
+    uint32_t magic = 0x95CBED1F;
+    out.write((char*)&magic, sizeof(uint32_t));
+
+    int bvh8_nodes = build_bvh8(out, tris);
+    if (!bvh8_nodes) {
+        std::cerr << "Cannot build a BVH8 using Embree" << std::endl;
+        return 1;
+    }
+    std::cout << "BVH8 successfully built (" << bvh8_nodes << " nodes)" << std::endl;
+
+    int bvh4_nodes = build_bvh4(out, tris);
+    if (!bvh4_nodes) {
+        std::cerr << "Cannot build a BVH4 using Embree" << std::endl;
+        return 1;
+    }
+    std::cout << "BVH4 successfully built (" << bvh4_nodes << " nodes)" << std::endl;
+
+    int bvh2_nodes = build_bvh2(out, tris);
+    if (!bvh2_nodes) {
+        std::cerr << "Cannot build a BVH2" << std::endl;
+        return 1;
+    }
+    std::cout << "BVH2 successfully built (" << bvh2_nodes << " nodes)" << std::endl;
+#endif
+
+    return 0;
+}